@@ -1,4 +1,13 @@
 #include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#if defined(__has_include) && __cplusplus >= 201703L
+#if __has_include(<any>)
+#include <any>
+#endif
+#endif
 #include "ttl/any.h"
 
 using ttl::any;
@@ -166,3 +175,94 @@ TEST(AnyTest, Iterate) {
 		ASSERT_FALSE(it(val));
 	}
 }
+
+namespace AnyTest {
+struct Counted {
+	static int copies;
+	static int alive;
+	int v;
+	explicit Counted(int val) : v(val) { alive++; }
+	Counted(const Counted& o) : v(o.v) { copies++; alive++; }
+	Counted(Counted&& o) noexcept : v(o.v) { alive++; }
+	~Counted() { alive--; }
+};
+int Counted::copies = 0;
+int Counted::alive = 0;
+
+struct Large {
+	char data[128];
+};
+}
+
+TEST(AnyTest, SmallBufferMove) {
+	using AnyTest::Counted;
+	Counted::copies = 0;
+	{
+		any a(Counted(1));
+		any b(std::move(a));
+		ASSERT_TRUE(a.empty());
+		ASSERT_EQ(1, b.get_reference<Counted>().v);
+		any c;
+		c = std::move(b);
+		ASSERT_TRUE(b.empty());
+		ASSERT_EQ(1, c.get_reference<Counted>().v);
+		ASSERT_EQ(0, Counted::copies);
+
+		any d = c;
+		ASSERT_EQ(1, Counted::copies);
+		ASSERT_EQ(1, d.get_reference<Counted>().v);
+		d = c;
+		ASSERT_EQ(2, Counted::copies);
+		ASSERT_EQ(2, Counted::alive);
+	}
+	ASSERT_EQ(0, Counted::alive);
+}
+
+TEST(AnyTest, SmallBufferLarge) {
+	AnyTest::Large l;
+	l.data[0] = 'x';
+	any a(l);
+	auto ptr = a.get_pointer<AnyTest::Large>();
+	// Large values stay on the heap, so moving keeps their address
+	any b(std::move(a));
+	ASSERT_EQ(ptr, b.get_pointer<AnyTest::Large>());
+	ASSERT_EQ('x', b.get<AnyTest::Large>().data[0]);
+
+	std::string str(100, 'y');
+	std::vector<any> args{ any(1), any(2.5), any(str) };
+	args.push_back(args[2].clone());
+	ASSERT_EQ(1, args[0].get<int>());
+	ASSERT_EQ(2.5, args[1].get<double>());
+	ASSERT_EQ(str, args[3].get<std::string>());
+}
+
+#ifdef __cpp_lib_any
+namespace {
+	// Build an argument pack of three values and copy it, like passing arguments through a type erased call
+	template<typename Any>
+	double measure_pack(size_t iterations) {
+		const std::string str = "a string longer than the small string buffer";
+		size_t sink = 0;
+		const auto begin = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; i++) {
+			std::vector<Any> args;
+			args.reserve(3);
+			args.emplace_back(static_cast<int>(i));
+			args.emplace_back(1.5);
+			args.emplace_back(str);
+			std::vector<Any> copy(args);
+			sink += copy.size();
+		}
+		const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		EXPECT_EQ(iterations * 3, sink);
+		return ms;
+	}
+}
+
+// ttl::any against std::any, run with --gtest_also_run_disabled_tests --gtest_filter='*BenchmarkAnyVsStdAny*'
+TEST(AnyTest, DISABLED_BenchmarkAnyVsStdAny) {
+	const size_t iterations = 1000000;
+	std::printf("%-10s %8.1f ms\n", "ttl::any", measure_pack<any>(iterations));
+	std::printf("%-10s %8.1f ms\n", "std::any", measure_pack<std::any>(iterations));
+}
+#endif
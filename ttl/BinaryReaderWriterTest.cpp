@@ -56,3 +56,129 @@ TEST(BinaryReaderWriterTest, WriteThenRead) {
 		ASSERT_EQ(orig, read);
 	}
 }
+
+TEST(BinaryReaderWriterTest, MemoryReader) {
+	std::stringstream sstream;
+	binary_writer wrt(sstream);
+	wrt.write(int32_t(-10));
+	wrt.write(3.5);
+	wrt.writeLEB(uint64_t(0xffffffffffffffffull));
+	wrt.writeLEB(int64_t(132));
+	wrt.write(std::string("Hello World"));
+	wrt.write(true);
+	const auto data = sstream.str();
+
+	memory_binary_reader rdr(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	ASSERT_EQ(-10, rdr.read_int32());
+	ASSERT_EQ(3.5, rdr.read_double());
+	ASSERT_EQ(0xffffffffffffffffull, rdr.read_unsigned_LEB());
+	ASSERT_EQ(132, rdr.read_LEB());
+	auto view = rdr.read_string_view();
+	ASSERT_EQ("Hello World", std::string(view.data(), view.size()));
+	ASSERT_EQ(data.data() + 4 + 8 + 10 + 2 + 1, view.data());
+	ASSERT_TRUE(rdr.read_bool());
+	ASSERT_EQ(0, rdr.get_source().remaining());
+	ASSERT_THROW(rdr.read_uint8(), std::runtime_error);
+
+	rdr.get_source().seek(0);
+	ASSERT_EQ(-10, rdr.read_int32());
+
+	// Truncated LEB and string
+	const uint8_t truncated[] = { 0x84, 0x84 };
+	memory_binary_reader rdr2(truncated, sizeof(truncated));
+	ASSERT_THROW(rdr2.read_unsigned_LEB(), std::runtime_error);
+	const uint8_t short_string[] = { 0x05, 'a', 'b' };
+	memory_binary_reader rdr3(short_string, sizeof(short_string));
+	ASSERT_THROW(rdr3.read_string_view(), std::runtime_error);
+}
+
+TEST(BinaryReaderWriterTest, BufferedWriter) {
+	std::stringstream sstream;
+	std::vector<uint64_t> values;
+	std::vector<int32_t> signed_values;
+	for (uint64_t i = 0; i < 1000; i++) {
+		values.push_back(i < 500 ? i % 100 : i * i * i * i * i * i);
+		signed_values.push_back(static_cast<int32_t>(i % 2 ? i : -static_cast<int64_t>(i)));
+	}
+	{
+		buffered_binary_writer wrt(sstream, 64);
+		wrt.write(int32_t(10));
+		wrt.writeLEB(values.data(), values.size());
+		wrt.writeZigZag(signed_values.data(), signed_values.size());
+		wrt.writeZigZag(int64_t(-1));
+		wrt.write(std::string(100, 'a'));
+		wrt.set_endian(endian::big);
+		wrt.write(uint32_t(0x01020304));
+		wrt.write(1.5f);
+	}
+
+	const auto data = sstream.str();
+	memory_binary_reader rdr(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	ASSERT_EQ(10, rdr.read_int32());
+	for (auto v : values)
+		ASSERT_EQ(v, rdr.read_unsigned_LEB());
+	for (auto v : signed_values)
+		ASSERT_EQ(v, rdr.read_zigzag());
+	ASSERT_EQ(1, rdr.get_source().current()[0]);
+	ASSERT_EQ(-1, rdr.read_zigzag());
+	ASSERT_EQ(std::string(100, 'a'), rdr.read_string());
+	const uint8_t expected[] = { 0x01, 0x02, 0x03, 0x04 };
+	ASSERT_EQ(0, memcmp(expected, rdr.get_source().current(), 4));
+	ASSERT_EQ(0x01020304u, convert_endian(rdr.read_uint32(), endian::big));
+	ASSERT_EQ(1.5f, convert_endian(rdr.read_float(), endian::big));
+	ASSERT_EQ(0, rdr.get_source().remaining());
+}
+
+TEST(BinaryReaderWriterTest, BufferedWriterArena) {
+	std::stringstream sstream;
+	uint8_t arena[16];
+	buffered_binary_writer wrt(sstream, arena, sizeof(arena));
+	wrt.write(uint64_t(1));
+	wrt.write(uint32_t(2));
+	ASSERT_EQ(0, sstream.str().size());
+	ASSERT_EQ(12, wrt.get_sink().buffered());
+	wrt.write(uint64_t(3));
+	ASSERT_EQ(12, sstream.str().size());
+	wrt.flush();
+	ASSERT_EQ(20, sstream.str().size());
+}
+
+TEST(BinaryReaderWriterTest, ArrayReadWrite) {
+	std::vector<float> floats;
+	std::vector<uint16_t> shorts;
+	for (size_t i = 0; i < 5000; i++) {
+		floats.push_back(static_cast<float>(i) * 0.5f);
+		shorts.push_back(static_cast<uint16_t>(i * 3));
+	}
+
+	for (auto e : { endian::little, endian::big }) {
+		std::stringstream sstream;
+		binary_writer wrt(sstream, e);
+		wrt.write_array(floats.data(), floats.size());
+		wrt.write_array(shorts.data(), shorts.size());
+		const auto data = sstream.str();
+		ASSERT_EQ(floats.size() * sizeof(float) + shorts.size() * sizeof(uint16_t), data.size());
+		// shorts[1] == 3
+		const size_t offset = floats.size() * sizeof(float) + 2;
+		ASSERT_EQ(e == endian::big ? 0 : 3, data[offset]);
+		ASSERT_EQ(e == endian::big ? 3 : 0, data[offset + 1]);
+
+		std::vector<float> rfloats(floats.size());
+		std::vector<uint16_t> rshorts(shorts.size());
+		binary_reader rdr(sstream, e);
+		rdr.read_array(rfloats.data(), rfloats.size());
+		rdr.read_array(rshorts.data(), rshorts.size());
+		ASSERT_EQ(floats, rfloats);
+		ASSERT_EQ(shorts, rshorts);
+
+		memory_binary_reader mrdr(reinterpret_cast<const uint8_t*>(data.data()), data.size(), e);
+		ASSERT_EQ(0.0f, mrdr.read_float());
+		ASSERT_EQ(0.5f, mrdr.read_float());
+		std::fill(rfloats.begin(), rfloats.end(), 0.0f);
+		mrdr.read_array(rfloats.data() + 2, rfloats.size() - 2);
+		ASSERT_EQ(floats.back(), rfloats.back());
+		mrdr.read_array(rshorts.data(), rshorts.size());
+		ASSERT_EQ(shorts, rshorts);
+		ASSERT_THROW(mrdr.read_array(rshorts.data(), 1), std::runtime_error);
+	}
+}
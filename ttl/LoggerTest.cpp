@@ -1,13 +1,26 @@
 #include <gtest/gtest.h>
 #include <sstream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
 
 #include "ttl/logger.h"
+#include "ttl/async_logger.h"
+#include "ttl/binary_logger.h"
+#include "ttl/file_logger.h"
+#include "ttl/io/inflate_stream.h"
 #include "ttl/string_util.h"
 
 using ttl::logger;
 using ttl::streamlogger;
 using ttl::loglevel;
 using ttl::logmodule;
+using ttl::async_logger;
 namespace string = ttl::string;
 
 TEST(LoggerTest, LogOutput) {
@@ -94,3 +107,452 @@ TEST(LoggerTest, LogOutputShort) {
 		ASSERT_TRUE(string::ends_with(logout.str(), " | INFO  | test | Hello Logger" + endl));
 	}
 }
+
+TEST(LoggerTest, AsyncLogger) {
+	std::ostringstream logout;
+	streamlogger target(logout, loglevel::TRACE);
+	{
+		async_logger log(target);
+		ASSERT_EQ(loglevel::INFO, log.get_loglevel());
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&log, t]() {
+				for (int i = 0; i < 1000; i++)
+					log << loglevel::INFO << logmodule("thread" + std::to_string(t)) << "Message " << i;
+				log << loglevel::DEBUG << "Filtered";
+			});
+		}
+		for (auto& t : threads) t.join();
+		log.flush();
+
+		auto lines = ttl::string::split(logout.str(), std::string("\n"));
+		size_t count = 0;
+		for (auto& l : lines) {
+			if (!l.empty()) count++;
+		}
+		ASSERT_EQ(4000, count);
+		ASSERT_EQ(std::string::npos, logout.str().find("Filtered"));
+		ASSERT_NE(std::string::npos, logout.str().find(" | thread0 | Message 999\n"));
+		ASSERT_EQ(0, log.get_dropped_count());
+	}
+}
+
+TEST(LoggerTest, AsyncLoggerTargetFilter) {
+	std::ostringstream logout;
+	streamlogger target(logout, loglevel::WARN);
+	static const logmodule quiet("async_filter_quiet");
+	target.set_loglevel(quiet, loglevel::ERR);
+	target.set_check_function([](loglevel, const std::string&, const std::string& msg) {
+		return msg.find("secret") == std::string::npos;
+	});
+	{
+		async_logger log(target, loglevel::TRACE);
+		log.info("test", "below target level");
+		log.warn("test", "written");
+		log.log(loglevel::WARN, quiet, "below module level");
+		log.log(loglevel::ERR, quiet, "module error");
+		log.logf(loglevel::INFO, "test", "formatted {}", 1);
+		log.logf(loglevel::ERR, "test", "{} secret", "checked");
+		log.flush();
+	}
+	const auto out = logout.str();
+	ASSERT_EQ(std::string::npos, out.find("below"));
+	ASSERT_EQ(std::string::npos, out.find("formatted"));
+	ASSERT_EQ(std::string::npos, out.find("secret"));
+	ASSERT_NE(std::string::npos, out.find("| test | written\n"));
+	ASSERT_NE(std::string::npos, out.find("| async_filter_quiet | module error\n"));
+}
+
+TEST(LoggerTest, AsyncLoggerThreadChurn) {
+	std::ostringstream logout;
+	streamlogger target(logout, loglevel::TRACE);
+	async_logger log(target);
+	for (int round = 0; round < 10; round++) {
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 10; t++) {
+			threads.emplace_back([&log, t]() {
+				log << loglevel::INFO << "Thread " << t;
+			});
+		}
+		for (auto& t : threads) t.join();
+		log.flush();
+		// Rings of exited threads are removed once drained
+		ASSERT_EQ(0u, log.get_ring_count());
+	}
+	auto lines = ttl::string::split(logout.str(), std::string("\n"));
+	size_t count = 0;
+	for (auto& l : lines) {
+		if (!l.empty()) count++;
+	}
+	ASSERT_EQ(100u, count);
+}
+
+namespace {
+	class blocking_logger : public logger {
+		std::mutex& m_block;
+	public:
+		std::atomic<size_t> lines;
+		std::vector<std::string> messages;
+
+		explicit blocking_logger(std::mutex& block)
+			: logger(loglevel::TRACE), m_block(block), lines(0)
+		{}
+	protected:
+		void write(loglevel, const std::string&, const std::string& msg) override {
+			std::unique_lock<std::mutex> lck(m_block);
+			messages.push_back(msg);
+			lines++;
+		}
+	};
+}
+
+TEST(LoggerTest, AsyncLoggerOverflow) {
+	std::mutex block;
+	blocking_logger target(block);
+	async_logger log(target, loglevel::INFO, async_logger::overflow_policy::count, 2);
+	ASSERT_EQ(async_logger::overflow_policy::count, log.get_overflow_policy());
+	{
+		std::unique_lock<std::mutex> lck(block);
+		for (int i = 0; i < 10; i++)
+			log.info("test", "Message");
+	}
+	log.flush();
+	ASSERT_GE(log.get_dropped_count(), 7);
+	ASSERT_EQ(10 - log.get_dropped_count() + 1, target.lines);
+	auto it = std::find(target.messages.begin(), target.messages.end(), "dropped " + std::to_string(log.get_dropped_count()) + " messages");
+	ASSERT_NE(target.messages.end(), it);
+}
+
+TEST(LoggerTest, FormatArgs) {
+	ttl::log_args args;
+	args.add(1, -2l, 3u, 1.5, 'c', true, "str", std::string("string"), loglevel::INFO == loglevel::INFO);
+	ASSERT_EQ(9, args.count());
+	ASSERT_EQ("a 1 b -2 c 3 {x} 1.5 c 1 str string 1", args.format("a {} b {} c {} {x} {}"));
+	args.clear();
+	ASSERT_TRUE(args.empty());
+	ASSERT_EQ("no {} args", args.format("no {} args"));
+}
+
+TEST(LoggerTest, LogFormatted) {
+	std::ostringstream logout;
+	streamlogger log(logout);
+
+	log.logf(loglevel::DEBUG, "test", "Filtered {}", 1);
+	ASSERT_TRUE(logout.str().empty());
+	log.logf(loglevel::INFO, "test", "Hello {} {}", "Logger", 42);
+	ASSERT_TRUE(string::ends_with(logout.str(), std::string(" | INFO  | test | Hello Logger 42\n")));
+
+	log.set_check_function([](loglevel, const std::string&, const std::string& msg) {
+		return msg != "Hello 1";
+	});
+	logout.str("");
+	log.logf(loglevel::INFO, "test", "Hello {}", 1);
+	ASSERT_TRUE(logout.str().empty());
+	log.logf(loglevel::INFO, "test", "Hello {}", 2);
+	ASSERT_TRUE(string::ends_with(logout.str(), std::string(" | INFO  | test | Hello 2\n")));
+
+	logout.str("");
+	{
+		async_logger alog(log);
+		alog.logf(loglevel::WARN, "async", "value {}", 1.25);
+		alog.flush();
+		ASSERT_TRUE(string::ends_with(logout.str(), std::string(" | WARN  | async | value 1.25\n")));
+	}
+}
+
+TEST(LoggerTest, BinaryLogger) {
+	std::stringstream out;
+	{
+		ttl::binarylogger log(out);
+		for (int i = 0; i < 3; i++)
+			log.logf(loglevel::INFO, "test", "Iteration {} of {}", i, 3);
+		log.warn("plain", "Hello Logger");
+		log.logf(loglevel::DEBUG, "test", "Filtered");
+	}
+
+	ttl::binary_log_reader reader(out);
+	ttl::log_entry entry;
+	for (int i = 0; i < 3; i++) {
+		ASSERT_TRUE(reader.read(entry));
+		ASSERT_EQ(loglevel::INFO, entry.level);
+		ASSERT_EQ("test", entry.module);
+		ASSERT_EQ("Iteration " + std::to_string(i) + " of 3", entry.message);
+	}
+	ASSERT_TRUE(reader.read(entry));
+	ASSERT_EQ(loglevel::WARN, entry.level);
+	ASSERT_EQ("plain", entry.module);
+	ASSERT_EQ("Hello Logger", entry.message);
+	ASSERT_LE(entry.time, std::chrono::system_clock::now());
+	ASSERT_FALSE(reader.read(entry));
+}
+
+TEST(LoggerTest, LogMacros) {
+	std::ostringstream logout;
+	streamlogger log(logout);
+
+	int evaluated = 0;
+	auto expensive = [&evaluated]() { evaluated++; return 42; };
+
+	TTL_DEBUG(log, "test", "Value {}", expensive());
+	ASSERT_EQ(0, evaluated);
+	ASSERT_TRUE(logout.str().empty());
+	TTL_INFO(log, "test", "Value {}", expensive());
+	ASSERT_EQ(1, evaluated);
+	ASSERT_TRUE(string::ends_with(logout.str(), std::string(" | INFO  | test | Value 42\n")));
+
+	ttl::static_logger<loglevel::WARN> slog(log);
+	ASSERT_FALSE(slog.is_enabled(loglevel::INFO));
+	ASSERT_TRUE(slog.is_enabled(loglevel::WARN));
+	logout.str("");
+	TTL_INFO(slog, "test", "Value {}", expensive());
+	slog.log(loglevel::INFO, "test", "Hello");
+	ASSERT_EQ(1, evaluated);
+	ASSERT_TRUE(logout.str().empty());
+	TTL_ERROR(slog, "test", "Value {}", expensive());
+	ASSERT_EQ(2, evaluated);
+	ASSERT_TRUE(string::ends_with(logout.str(), std::string(" | ERROR | test | Value 42\n")));
+}
+
+TEST(LoggerTest, StreamDisabled) {
+	std::ostringstream logout;
+	streamlogger log(logout, loglevel::WARN);
+
+	log(loglevel::INFO, "test") << "Hello " << 1;
+	log << loglevel::DEBUG << logmodule("test") << "Hello";
+	ASSERT_TRUE(logout.str().empty());
+	log(loglevel::WARN, "test");
+	ASSERT_TRUE(string::ends_with(logout.str(), std::string(" | WARN  | test | \n")));
+}
+
+namespace {
+	struct timed_logger : streamlogger {
+		using streamlogger::streamlogger;
+		using streamlogger::write_at;
+	};
+}
+
+TEST(LoggerTest, Timestamps) {
+	std::ostringstream logout;
+	timed_logger log(logout);
+	ttl::logger& base = log;
+
+	// 2020-01-02 03:04:05.123456789 UTC
+	const std::chrono::system_clock::time_point tp(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(1577934245123456789LL)));
+	log.set_timestamp_mode(streamlogger::timestamp_mode::utc);
+	log.set_timeformat("%Y-%m-%d %H:%M:%S");
+	log.set_subsecond_digits(3);
+	ASSERT_EQ(3u, log.get_subsecond_digits());
+	log.write_at(loglevel::INFO, "test", "Hello", tp);
+	ASSERT_EQ("2020-01-02 03:04:05.123 | INFO  | test | Hello\n", logout.str());
+
+	// Same second is served from the cache, next second is reformatted
+	logout.str("");
+	log.write_at(loglevel::INFO, "test", "Hello", tp + std::chrono::milliseconds(500));
+	log.write_at(loglevel::INFO, "test", "Hello", tp + std::chrono::milliseconds(900));
+	ASSERT_EQ("2020-01-02 03:04:05.623 | INFO  | test | Hello\n2020-01-02 03:04:06.023 | INFO  | test | Hello\n", logout.str());
+
+	logout.str("");
+	log.set_timeformat("%H:%M");
+	log.set_subsecond_digits(0);
+	log.write_at(loglevel::WARN, "test", "Hello", tp);
+	ASSERT_EQ("03:04 | WARN  | test | Hello\n", logout.str());
+
+	logout.str("");
+	log.set_timestamp_mode(streamlogger::timestamp_mode::epoch_ns);
+	log.write_at(loglevel::INFO, "test", "Hello", tp);
+	const auto expected = std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count()) + " | INFO  | test | Hello\n";
+	ASSERT_EQ(expected, logout.str());
+
+	logout.str("");
+	log.set_timestamp_mode(streamlogger::timestamp_mode::monotonic);
+	log.set_subsecond_digits(6);
+	base.log(loglevel::INFO, "test", "Hello");
+	const auto str = logout.str();
+	ASSERT_NE(std::string::npos, str.find('.'));
+	ASSERT_EQ(6u, str.find(' ') - str.find('.') - 1);
+	ASSERT_TRUE(string::ends_with(str, std::string(" | INFO  | test | Hello\n")));
+}
+
+namespace {
+	std::string temp_log_file() {
+		char buf[L_tmpnam];
+		auto res = tmpnam(buf);
+		return res ? res : "";
+	}
+
+	std::string read_file(const std::string& path) {
+		std::ifstream in(path, std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+}
+
+TEST(LoggerTest, FileLoggerRotateSize) {
+	const auto path = temp_log_file();
+	ASSERT_FALSE(path.empty());
+	ttl::rotation_options options;
+	options.max_size = 50;
+	options.max_files = 2;
+	{
+		ttl::file_logger log(path, loglevel::INFO, options);
+		ASSERT_FALSE(log.get_autoflush());
+		// Every line is 24 bytes, so two fit into one file
+		log.set_timeformat("");
+		for (int i = 1; i <= 7; i++)
+			TTL_INFO(log, "test", "msg0{}", i);
+		log.flush();
+		log.wait_rotation();
+	}
+	ASSERT_EQ(" | INFO  | test | msg07\n", read_file(path));
+	ASSERT_EQ(" | INFO  | test | msg05\n | INFO  | test | msg06\n", read_file(path + ".1"));
+	ASSERT_EQ(" | INFO  | test | msg03\n | INFO  | test | msg04\n", read_file(path + ".2"));
+	ASSERT_FALSE(std::ifstream(path + ".3").good());
+	ASSERT_EQ(0, remove(path.c_str()));
+	ASSERT_EQ(0, remove((path + ".1").c_str()));
+	ASSERT_EQ(0, remove((path + ".2").c_str()));
+}
+
+TEST(LoggerTest, FileLoggerCompress) {
+	const auto path = temp_log_file();
+	ASSERT_FALSE(path.empty());
+	ttl::rotation_options options;
+	options.compress = true;
+	options.max_files = 1;
+	{
+		ttl::file_logger log(path, loglevel::INFO, options);
+		log.set_timeformat("");
+		log.log(loglevel::INFO, "test", "Hello");
+		log.rotate();
+		log.log(loglevel::INFO, "test", "World");
+	}
+	ASSERT_EQ(" | INFO  | test | World\n", read_file(path));
+	{
+		std::ifstream file(path + ".1.gz", std::ios::binary);
+		ASSERT_TRUE(file.good());
+		ttl::io::inflate_istream in(file, 15, ttl::io::inflater::wrapper::gzip);
+		std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		ASSERT_EQ(" | INFO  | test | Hello\n", content);
+	}
+	ASSERT_EQ(0, remove(path.c_str()));
+	ASSERT_EQ(0, remove((path + ".1.gz").c_str()));
+}
+
+TEST(LoggerTest, FileLoggerLeftoverPending) {
+	const auto path = temp_log_file();
+	ASSERT_FALSE(path.empty());
+	// Rotated files of a process that exited before archiving them
+	std::ofstream(path + ".pending.3") << "old";
+	std::ofstream(path + ".pending.7") << "newer";
+	std::ofstream(path + ".pending.x") << "other";
+	ttl::rotation_options options;
+	options.max_files = 3;
+	{
+		ttl::file_logger log(path, loglevel::INFO, options);
+		log.set_timeformat("");
+		log.log(loglevel::INFO, "test", "Hello");
+		log.rotate();
+		log.wait_rotation();
+	}
+	ASSERT_EQ(" | INFO  | test | Hello\n", read_file(path + ".1"));
+	ASSERT_EQ("newer", read_file(path + ".2"));
+	ASSERT_EQ("old", read_file(path + ".3"));
+	ASSERT_EQ("other", read_file(path + ".pending.x"));
+	ASSERT_FALSE(std::ifstream(path + ".pending.8").good());
+	ASSERT_EQ(0, remove(path.c_str()));
+	ASSERT_EQ(0, remove((path + ".1").c_str()));
+	ASSERT_EQ(0, remove((path + ".2").c_str()));
+	ASSERT_EQ(0, remove((path + ".3").c_str()));
+	ASSERT_EQ(0, remove((path + ".pending.x").c_str()));
+}
+
+TEST(LoggerTest, ModuleLevels) {
+	std::ostringstream logout;
+	streamlogger log(logout, loglevel::INFO);
+	const logmodule net("net");
+	const logmodule db("db");
+
+	ASSERT_NE(0u, net.id);
+	ASSERT_NE(net.id, db.id);
+	ASSERT_EQ(net.id, logmodule("net").id);
+	ASSERT_EQ("net", ttl::module_registry::instance().get_name(net.id));
+
+	log.set_loglevel(net, loglevel::DEBUG);
+	log.set_loglevel(db, loglevel::ERR);
+	ASSERT_TRUE(log.is_enabled(loglevel::DEBUG, net));
+	ASSERT_FALSE(log.is_enabled(loglevel::WARN, db));
+	ASSERT_FALSE(log.is_enabled(loglevel::DEBUG));
+
+	int evaluated = 0;
+	auto expensive = [&evaluated]() { evaluated++; return 1; };
+	TTL_DEBUG(log, net, "net {}", expensive());
+	TTL_WARN(log, db, "db {}", expensive());
+	log.log(loglevel::WARN, db, "dropped");
+	log(loglevel::DEBUG, net) << "stream";
+	log << loglevel::DEBUG << db << "dropped";
+	ASSERT_EQ(1, evaluated);
+	auto str = logout.str();
+	ASSERT_NE(std::string::npos, str.find("| DEBUG | net | net 1\n"));
+	ASSERT_NE(std::string::npos, str.find("| DEBUG | net | stream\n"));
+	ASSERT_EQ(std::string::npos, str.find("dropped"));
+	ASSERT_EQ(std::string::npos, str.find("| db |"));
+
+	// Modules without override follow the global level
+	log.reset_loglevel(net);
+	log.set_loglevel(loglevel::TRACE);
+	ASSERT_EQ(loglevel::TRACE, log.get_loglevel(net));
+	ASSERT_EQ(loglevel::ERR, log.get_loglevel(db));
+}
+
+namespace {
+	// Discards everything, so only formatting is measured
+	class null_buffer : public std::streambuf {
+	protected:
+		std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+		int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+	};
+
+	// streamlogger::write_at before the timestamp cache: localtime_r and put_time for every line
+	void write_uncached(std::ostream& out, std::mutex& mtx, const std::string& module, const std::string& message) {
+		const auto tp = std::chrono::system_clock::now();
+		std::string strlevel = "INFO ";
+		time_t nt = std::chrono::system_clock::to_time_t(tp);
+		struct tm t;
+#ifdef _WIN32
+		localtime_s(&t, &nt);
+#else
+		localtime_r(&nt, &t);
+#endif
+		std::unique_lock<std::mutex> lck(mtx);
+		out << std::put_time(&t, "%c") << " | " << strlevel << " | " << module << " | " << message << '\n';
+	}
+
+	template<typename Func>
+	double ns_per_line(size_t lines, Func fn) {
+		const auto begin = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < lines; i++)
+			fn();
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / static_cast<double>(lines);
+	}
+}
+
+// Per line cost of streamlogger before and after the timestamp cache, run with --gtest_also_run_disabled_tests --gtest_filter='*BenchmarkTimestamp*'
+TEST(LoggerTest, DISABLED_BenchmarkTimestamp) {
+	const size_t lines = 1000000;
+	const std::string module = "bench";
+	const std::string message = "Hello Logger";
+	null_buffer buf;
+	std::ostream out(&buf);
+
+	std::mutex mtx;
+	std::printf("%-20s %8.1f ns/line\n", "uncached", ns_per_line(lines, [&]() { write_uncached(out, mtx, module, message); }));
+
+	streamlogger log(out, loglevel::INFO);
+	log.set_autoflush(false);
+	std::printf("%-20s %8.1f ns/line\n", "cached local", ns_per_line(lines, [&]() { log.log(loglevel::INFO, module, message); }));
+	log.set_subsecond_digits(6);
+	std::printf("%-20s %8.1f ns/line\n", "cached local + us", ns_per_line(lines, [&]() { log.log(loglevel::INFO, module, message); }));
+	log.set_timestamp_mode(streamlogger::timestamp_mode::utc);
+	std::printf("%-20s %8.1f ns/line\n", "cached utc + us", ns_per_line(lines, [&]() { log.log(loglevel::INFO, module, message); }));
+	log.set_timestamp_mode(streamlogger::timestamp_mode::epoch_ns);
+	std::printf("%-20s %8.1f ns/line\n", "epoch_ns", ns_per_line(lines, [&]() { log.log(loglevel::INFO, module, message); }));
+}
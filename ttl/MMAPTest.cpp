@@ -3,6 +3,9 @@
 #include <cstdio>
 
 #include "ttl/mmap.h"
+#include "ttl/io/mmap_stream.h"
+#include "ttl/windowed_mmap.h"
+#include "ttl/binary_writer.h"
 
 using namespace ttl;
 
@@ -47,6 +50,10 @@ TEST_F(MMAPTest, MapFile) {
 	ASSERT_EQ(map.data(), &map.at(0));
 	ASSERT_EQ(data.size(), map.size());
 	ASSERT_TRUE(memcmp(data.data(), map.data(), map.size()) == 0);
+	ASSERT_EQ(&map[map.size() - 1], &map.at(map.size() - 1));
+	ASSERT_THROW(map.at(map.size()), std::out_of_range);
+	const auto& cmap = map;
+	ASSERT_THROW(cmap.at(cmap.size()), std::out_of_range);
 }
 
 TEST_F(MMAPTest, MapFileFailed) {
@@ -74,3 +81,123 @@ TEST_F(MMAPTest, MapFileConstructor) {
 	ASSERT_EQ(data.size(), map.size());
 	ASSERT_TRUE(memcmp(data.data(), map.data(), map.size()) == 0);
 }
+
+TEST_F(MMAPTest, MapFileWritable) {
+	ttl::mmap map;
+
+	ASSERT_TRUE(map.open(mmap_file, ttl::mmap::access::read_write));
+	ASSERT_TRUE(map.is_writable());
+	ASSERT_EQ(data.size(), map.size());
+	map[0] = 'J';
+	ASSERT_TRUE(map.flush());
+
+	ASSERT_TRUE(map.resize(8192));
+	ASSERT_EQ(8192, map.size());
+	ASSERT_EQ(8192, map.file_size());
+	ASSERT_EQ('J', map[0]);
+	ASSERT_EQ(0, map[8191]);
+	map[8191] = 'X';
+	ASSERT_TRUE(map.flush(8000, 192, true));
+
+	ASSERT_TRUE(map.resize(5));
+	ASSERT_EQ(5, map.size());
+	map.close();
+
+	std::ifstream file(mmap_file, std::ios::binary);
+	std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	ASSERT_EQ("Jello", content);
+}
+
+TEST_F(MMAPTest, MapFileWritableEmpty) {
+	ASSERT_EQ(remove(mmap_file.c_str()), 0);
+
+	ttl::mmap map;
+	ASSERT_TRUE(map.open(mmap_file, ttl::mmap::access::read_write));
+	ASSERT_TRUE(map.is_open());
+	ASSERT_FALSE(map.is_valid());
+	ASSERT_TRUE(map.resize(data.size()));
+	ASSERT_TRUE(map.is_valid());
+	memcpy(map.data(), data.data(), data.size());
+	map.close();
+
+	ttl::mmap rmap(mmap_file);
+	ASSERT_FALSE(rmap.is_writable());
+	ASSERT_FALSE(rmap.resize(0));
+	ASSERT_EQ(data.size(), rmap.size());
+	ASSERT_TRUE(memcmp(data.data(), rmap.data(), rmap.size()) == 0);
+}
+
+TEST_F(MMAPTest, MappedOutputStream) {
+	std::string expected;
+	{
+		ttl::io::mmap_ostream stream(mmap_file, 16);
+		ttl::binary_writer writer(stream);
+		for (uint32_t i = 0; i < 10000; i++) {
+			writer.write(i);
+			expected.append(reinterpret_cast<const char*>(&i), sizeof(i));
+		}
+		writer.write(data);
+		expected += static_cast<char>(data.size());
+		expected += data;
+		ASSERT_EQ(expected.size(), stream.size());
+		ASSERT_EQ(std::streampos(expected.size()), stream.tellp());
+		stream.seekp(0);
+		writer.write(uint32_t(0xffffffff));
+		expected.replace(0, 4, 4, static_cast<char>(0xff));
+		stream.flush();
+		ASSERT_TRUE(stream.flush_to_disk());
+	}
+
+	std::ifstream file(mmap_file, std::ios::binary);
+	std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	ASSERT_EQ(expected, content);
+}
+
+TEST_F(MMAPTest, WindowedRead) {
+	const size_t page = ttl::mmap::page_size();
+	std::string content;
+	for (size_t i = 0; i < page * 10 + 123; i++)
+		content += static_cast<char>(i * 7);
+	{
+		std::ofstream file(mmap_file, std::ios::trunc | std::ios::binary);
+		file.write(content.data(), static_cast<std::streamsize>(content.size()));
+	}
+
+	for (bool prefetch : { false, true }) {
+		ttl::windowed_mmap map(mmap_file, page, 3, prefetch);
+		ASSERT_TRUE(map.is_open());
+		ASSERT_EQ(content.size(), map.size());
+		ASSERT_EQ(page, map.window_size());
+
+		// Read in chunks crossing window boundaries
+		auto cur = map.begin();
+		std::string read;
+		std::vector<char> buf(page / 3 + 1);
+		while (!cur.eof()) {
+			auto n = cur.read(buf.data(), buf.size());
+			read.append(buf.data(), n);
+			ASSERT_LE(map.mapped_windows(), map.max_windows());
+		}
+		ASSERT_EQ(content, read);
+		ASSERT_EQ(0, cur.read(buf.data(), buf.size()));
+
+		// Random access
+		cur.seek(page * 5 - 1);
+		ASSERT_EQ(static_cast<uint8_t>(content[page * 5 - 1]), cur.get());
+		size_t avail = 0;
+		auto ptr = cur.data(avail);
+		ASSERT_EQ(page, avail);
+		ASSERT_EQ(static_cast<uint8_t>(content[page * 5]), *ptr);
+		cur.seek(content.size() - 1);
+		ASSERT_EQ(static_cast<uint8_t>(content.back()), cur.get());
+		ASSERT_TRUE(cur.eof());
+		ASSERT_THROW(cur.get(), std::out_of_range);
+	}
+}
+
+TEST_F(MMAPTest, WindowedReadFailed) {
+	ttl::windowed_mmap map;
+	ASSERT_FALSE(map.open("mmap_test_not_existent.txt"));
+	ASSERT_FALSE(map.is_open());
+	ASSERT_THROW(ttl::windowed_mmap("mmap_test_not_existent.txt"), std::runtime_error);
+}
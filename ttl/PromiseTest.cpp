@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 #include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdio>
 
 #include "ttl/promise.h"
 
@@ -438,3 +441,273 @@ TEST(PromiseTest, WaitFor) {
     ASSERT_EQ(t->get_state(), promise<int>::state::resolved);
     ASSERT_EQ(t->get(), 10);
 }
+
+TEST(PromiseTest, ThenChain) {
+    promise<int>::resolve_fn_t mresolve;
+    auto t = promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+        mresolve = resolve;
+    });
+    bool observed = false;
+    auto res = t->then([](int v) {
+        return std::to_string(v);
+    })->then([&](std::string& s) {
+        ASSERT_EQ(s, "10");
+        observed = true;
+    })->then([](std::string& s) {
+        return promise<size_t>::resolve(s.size());
+    });
+    ASSERT_EQ(res->get_state(), promise<size_t>::state::pending);
+
+    mresolve(10);
+
+    ASSERT_TRUE(observed);
+    ASSERT_EQ(res->get_state(), promise<size_t>::state::resolved);
+    ASSERT_EQ(res->get(), 2u);
+}
+
+TEST(PromiseTest, ThenChainReject) {
+    bool error_executed = false;
+    bool resolve_executed = false;
+    auto t = promise<int>::resolve(10)->then([](int) -> int {
+        throw std::runtime_error("failed");
+    })->then([&](int v) {
+        resolve_executed = true;
+        return v;
+    }, [&](std::exception_ptr) {
+        error_executed = true;
+    });
+    ASSERT_TRUE(error_executed);
+    ASSERT_FALSE(resolve_executed);
+    ASSERT_EQ(t->get_state(), promise<int>::state::rejected);
+    ASSERT_THROW(t->get(), std::runtime_error);
+}
+
+TEST(PromiseTest, ConcurrentThen) {
+    for (int round = 0; round < 50; round++) {
+        promise<int>::resolve_fn_t mresolve;
+        auto t = promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+            mresolve = resolve;
+        });
+        std::atomic<int> calls(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&]() {
+                for (int j = 0; j < 25; j++)
+                    t->then([&](int v) { calls += v; });
+            });
+        }
+        threads.emplace_back([&]() { mresolve(1); });
+        for (auto& th : threads)
+            th.join();
+        // Every continuation runs exactly once, no matter if it was added before or after resolving
+        ASSERT_EQ(calls, 100);
+    }
+}
+
+TEST(PromiseTest, ThenOnExecutor) {
+    ttl::thread_executor ex;
+    std::thread::id worker;
+    ex.post([&]() { worker = std::this_thread::get_id(); });
+    ex.wait_idle();
+
+    promise<int>::resolve_fn_t mresolve;
+    auto t = promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+        mresolve = resolve;
+    });
+    std::atomic<bool> release(false);
+    std::thread::id called_on;
+    auto res = t->then_on(ex.executor(), [&](int v) {
+        while (!release) std::this_thread::yield();
+        called_on = std::this_thread::get_id();
+        return v * 2;
+    });
+    // Resolving only posts the continuation
+    mresolve(21);
+    ASSERT_EQ(res->get_state(), promise<int>::state::pending);
+    release = true;
+    ASSERT_EQ(res->get(), 42);
+    ASSERT_EQ(called_on, worker);
+}
+
+TEST(PromiseTest, CreateOnExecutor) {
+    ttl::thread_pool pool(2);
+    auto t = promise<int>::create([](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+        resolve(10);
+    }, pool.executor());
+    ASSERT_EQ(t->get(), 10);
+
+    auto err = promise<int>::create([](promise<int>::resolve_fn_t, promise<int>::reject_fn_t){
+        throw std::runtime_error("failed");
+    }, pool.executor());
+    ASSERT_THROW(err->get(), std::runtime_error);
+
+    ttl::timer timer;
+    auto start = std::chrono::steady_clock::now();
+    auto delayed = promise<int>::resolve(1)->then_on(ttl::timer_executor(timer, std::chrono::milliseconds(20)), [](int v) {
+        return v + 1;
+    });
+    ASSERT_EQ(delayed->get(), 2);
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+    auto inline_res = promise<int>::resolve(1)->then_on(ttl::inline_executor(), [](int v) { return v + 1; });
+    ASSERT_EQ(inline_res->get_state(), promise<int>::state::resolved);
+}
+
+TEST(PromiseTest, AllMany) {
+    std::vector<promise<int>::resolve_fn_t> resolvers;
+    std::vector<promise<int>::ptr> children;
+    for (int i = 0; i < 10000; i++) {
+        children.push_back(promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+            resolvers.push_back(resolve);
+        }));
+    }
+    auto t = promise<int>::all(children);
+    std::vector<std::thread> threads;
+    for (size_t th = 0; th < 4; th++) {
+        threads.emplace_back([&, th]() {
+            for (size_t i = th; i < resolvers.size(); i += 4)
+                resolvers[i](static_cast<int>(i));
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    ASSERT_EQ(t->get_state(), promise<int>::state::resolved);
+    auto& v = t->get();
+    ASSERT_EQ(v.size(), 10000u);
+    for (int i = 0; i < 10000; i++)
+        ASSERT_EQ(v[i], i);
+
+    ASSERT_TRUE(promise<int>::all({})->get().empty());
+}
+
+TEST(PromiseTest, AllSettled) {
+    auto t = promise<int>::all_settled({ promise<int>::resolve(1), promise<int>::reject(nullptr) });
+    ASSERT_EQ(t->get_state(), promise<int>::state::resolved);
+    auto& v = t->get();
+    ASSERT_EQ(v.size(), 2u);
+    ASSERT_EQ(v[0].status, ttl::promise_state::resolved);
+    ASSERT_EQ(v[0].value.value(), 1);
+    ASSERT_EQ(v[1].status, ttl::promise_state::rejected);
+    ASSERT_FALSE(v[1].value.has_value());
+}
+
+TEST(PromiseTest, Any) {
+    promise<int>::resolve_fn_t mresolve;
+    auto pending = promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+        mresolve = resolve;
+    });
+    auto t = promise<int>::any({ promise<int>::reject(nullptr), pending });
+    ASSERT_EQ(t->get_state(), promise<int>::state::pending);
+    mresolve(5);
+    ASSERT_EQ(t->get(), 5);
+
+    auto failed = promise<int>::any({ promise<int>::reject(nullptr), promise<int>::reject(nullptr) });
+    ASSERT_EQ(failed->get_state(), promise<int>::state::rejected);
+    try {
+        std::rethrow_exception(failed->get_error());
+        FAIL();
+    } catch (const ttl::aggregate_error& e) {
+        ASSERT_EQ(e.errors.size(), 2u);
+    }
+}
+
+#ifdef TTL_HAS_COROUTINES
+namespace {
+    ttl::task<int> add_one(promise<int>::ptr p) {
+        int v = co_await p;
+        co_return v + 1;
+    }
+
+    ttl::task<int> add_two(promise<int>::ptr p) {
+        int v = co_await add_one(p);
+        co_return v + 1;
+    }
+
+    ttl::task<int> fail(promise<int>::ptr p) {
+        co_await p;
+        throw std::runtime_error("failed");
+    }
+
+    ttl::task<int> catch_error(ttl::task<int> t) {
+        try {
+            co_await t;
+        } catch (const std::runtime_error&) {
+            co_return -1;
+        }
+        co_return 0;
+    }
+}
+
+TEST(PromiseTest, CoroutineAwait) {
+    promise<int>::resolve_fn_t mresolve;
+    auto p = promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+        mresolve = resolve;
+    });
+    auto t1 = add_two(p);
+    // Second awaiter of the same promise
+    auto t2 = add_one(p);
+    ASSERT_EQ(t1.get_promise()->get_state(), promise<int>::state::pending);
+    std::thread([&]() { mresolve(1); }).join();
+    ASSERT_EQ(t1.get_promise()->get(), 3);
+    ASSERT_EQ(t2.get_promise()->get(), 2);
+
+    // Already resolved promises do not suspend
+    ASSERT_EQ(add_one(promise<int>::resolve(5)).get_promise()->get_state(), promise<int>::state::resolved);
+}
+
+TEST(PromiseTest, CoroutineReject) {
+    promise<int>::resolve_fn_t mresolve;
+    auto p = promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t){
+        mresolve = resolve;
+    });
+    promise<int>::ptr res = catch_error(fail(p));
+    ASSERT_EQ(res->get_state(), promise<int>::state::pending);
+    mresolve(1);
+    ASSERT_EQ(res->get(), -1);
+    ASSERT_THROW(fail(promise<int>::resolve(1)).get_promise()->get(), std::runtime_error);
+}
+#endif
+
+namespace {
+    // Create count pending promises, settle(i, resolve, reject) settles child i
+    template<typename Combine, typename Settle>
+    double measure_combinator(size_t count, Combine combine, Settle settle) {
+        std::vector<promise<int>::resolve_fn_t> resolvers;
+        std::vector<promise<int>::reject_fn_t> rejecters;
+        std::vector<promise<int>::ptr> children;
+        resolvers.reserve(count);
+        rejecters.reserve(count);
+        children.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            children.push_back(promise<int>::create([&](promise<int>::resolve_fn_t resolve, promise<int>::reject_fn_t reject) {
+                resolvers.push_back(resolve);
+                rejecters.push_back(reject);
+            }));
+        }
+        const auto begin = std::chrono::steady_clock::now();
+        auto res = combine(std::move(children));
+        for (size_t i = 0; i < count; i++)
+            settle(i, resolvers[i], rejecters[i]);
+        const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        EXPECT_NE(promise<int>::state::pending, res->get_state());
+        return ms;
+    }
+}
+
+// Combining and settling 10k to 1M children, run with --gtest_also_run_disabled_tests --gtest_filter='*BenchmarkAll*'
+TEST(PromiseTest, DISABLED_BenchmarkAll) {
+    std::printf("%10s %12s %14s %12s\n", "children", "all ms", "all_settled ms", "any ms");
+    for (size_t count : { 10000u, 100000u, 1000000u }) {
+        const auto all = measure_combinator(count, [](std::vector<promise<int>::ptr> l) { return promise<int>::all(std::move(l)); },
+            [](size_t i, promise<int>::resolve_fn_t& resolve, promise<int>::reject_fn_t&) { resolve(static_cast<int>(i)); });
+        const auto all_settled = measure_combinator(count, [](std::vector<promise<int>::ptr> l) { return promise<int>::all_settled(std::move(l)); },
+            [](size_t i, promise<int>::resolve_fn_t& resolve, promise<int>::reject_fn_t& reject) {
+                if (i % 2) reject(nullptr);
+                else resolve(static_cast<int>(i));
+            });
+        // Every child rejects, so any() has to collect all errors
+        const auto any = measure_combinator(count, [](std::vector<promise<int>::ptr> l) { return promise<int>::any(std::move(l)); },
+            [](size_t, promise<int>::resolve_fn_t&, promise<int>::reject_fn_t& reject) { reject(nullptr); });
+        std::printf("%10zu %12.1f %14.1f %12.1f\n", count, all, all_settled, any);
+    }
+}
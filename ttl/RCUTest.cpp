@@ -1,5 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
 #include "ttl/rcu.h"
 
 using namespace ttl;
@@ -43,3 +51,237 @@ TEST(RCUTest, RCUUpdateThrow) {
 	auto ptr = test.get();
 	ASSERT_EQ(old, ptr);
 }
+
+TEST(RCUTest, RCUReadLock) {
+	rcu<std::string> test("Test");
+	{
+		auto guard = test.read_lock();
+		ASSERT_EQ("Test", *guard);
+		ASSERT_EQ(4u, guard->size());
+		// Nested read side critical sections are allowed
+		auto inner = test.read_lock();
+		ASSERT_EQ(guard.get(), inner.get());
+	}
+	test.update([](std::string& str) { str = "Updated"; });
+	ASSERT_EQ("Updated", *test.read_lock());
+}
+
+TEST(RCUTest, RCUReclaimWaitsForReaders) {
+	rcu<std::shared_ptr<std::string>> test(std::make_shared<std::string>("Test"));
+	std::weak_ptr<std::string> old = *test.get();
+	{
+		auto guard = test.read_lock();
+		// Writers no longer wait for readers, even on the same thread
+		test.update([](std::shared_ptr<std::string>& str) { str = std::make_shared<std::string>("Updated"); });
+		ASSERT_EQ("Updated", **test.get());
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		// The old version is not freed while the guard exists
+		ASSERT_FALSE(old.expired());
+		ASSERT_EQ("Test", **guard);
+	}
+	rcu_domain::instance().barrier();
+	ASSERT_TRUE(old.expired());
+}
+
+TEST(RCUTest, RCUDeferredFree) {
+	rcu<std::shared_ptr<std::string>> test(std::make_shared<std::string>("Test"));
+	auto snapshot = test.get();
+	std::weak_ptr<std::string> old = *snapshot;
+	test.update([](std::shared_ptr<std::string>& str) { str = std::make_shared<std::string>("Updated"); });
+	rcu_domain::instance().barrier();
+	ASSERT_FALSE(old.expired());
+	// Dropping the last reference only queues the version for the reclaimer thread
+	snapshot.reset();
+	rcu_domain::instance().barrier();
+	ASSERT_TRUE(old.expired());
+}
+
+TEST(RCUTest, RCUCallRCU) {
+	auto& domain = rcu_domain::instance();
+	std::atomic<bool> called(false);
+	std::atomic<bool> in_reclaimer(false);
+	{
+		domain.read_lock();
+		domain.call_rcu([&]() {
+			in_reclaimer = rcu_domain::in_reclaimer();
+			called = true;
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		// Still inside the read side critical section
+		ASSERT_FALSE(called);
+		domain.read_unlock();
+	}
+	domain.barrier();
+	ASSERT_TRUE(called);
+	ASSERT_TRUE(in_reclaimer);
+	ASSERT_FALSE(rcu_domain::in_reclaimer());
+}
+
+TEST(RCUTest, RCUConcurrentReaders) {
+	rcu<std::vector<int>> test(100, 0);
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; t++) {
+		readers.emplace_back([&]() {
+			while (!stop) {
+				auto guard = test.read_lock();
+				// Every version has all elements set to the same value
+				for (auto v : *guard)
+					ASSERT_EQ((*guard)[0], v);
+			}
+		});
+	}
+	for (int i = 1; i <= 100; i++) {
+		test.update([i](std::vector<int>& v) {
+			for (auto& e : v) e = i;
+		});
+	}
+	stop = true;
+	for (auto& t : readers)
+		t.join();
+	ASSERT_EQ(100, (*test.get())[0]);
+}
+
+TEST(RCUTest, RCUEnqueueCommit) {
+	rcu<std::vector<int>> test;
+	auto old = test.get();
+	for (int i = 0; i < 10; i++)
+		test.enqueue([i](std::vector<int>& v) { v.push_back(i); });
+	// A failing mutation is skipped without losing the others
+	test.enqueue([](std::vector<int>& v) {
+		v.clear();
+		throw std::runtime_error("");
+	});
+	ASSERT_EQ(old, test.get());
+	test.commit();
+	auto ptr = test.get();
+	ASSERT_EQ(10u, ptr->size());
+	for (int i = 0; i < 10; i++)
+		ASSERT_EQ(i, (*ptr)[i]);
+	// Nothing queued, nothing published
+	test.commit();
+	ASSERT_EQ(ptr, test.get());
+}
+
+TEST(RCUTest, RCUUpdateBatched) {
+	rcu<std::vector<int>> test;
+	std::vector<std::thread> writers;
+	for (int t = 0; t < 8; t++) {
+		writers.emplace_back([&test, t]() {
+			for (int i = 0; i < 50; i++)
+				test.update_batched([t](std::vector<int>& v) { v.push_back(t); });
+		});
+	}
+	for (auto& t : writers)
+		t.join();
+	ASSERT_EQ(400u, test.get()->size());
+
+	ASSERT_THROW(test.update_batched([](std::vector<int>& v) {
+		v.clear();
+		throw std::runtime_error("");
+	}), std::runtime_error);
+	ASSERT_EQ(400u, test.get()->size());
+}
+
+namespace {
+	struct throwing_copy {
+		static std::atomic<bool> fail;
+		std::vector<int> values;
+
+		throwing_copy() = default;
+		throwing_copy(const throwing_copy& other)
+			: values(other.values)
+		{
+			if (fail)
+				throw std::runtime_error("copy");
+		}
+	};
+	std::atomic<bool> throwing_copy::fail(false);
+}
+
+TEST(RCUTest, RCUUpdateBatchedCopyThrows) {
+	rcu<throwing_copy> test;
+	test.enqueue([](throwing_copy& v) { v.values.push_back(1); });
+	throwing_copy::fail = true;
+	// Every waiting writer of the batch sees the failure instead of returning as if it was applied
+	ASSERT_THROW(test.update_batched([](throwing_copy& v) { v.values.push_back(2); }), std::runtime_error);
+	ASSERT_THROW(test.commit(), std::runtime_error);
+	ASSERT_TRUE(test.get()->values.empty());
+	throwing_copy::fail = false;
+	// The queued mutation was kept
+	test.commit();
+	ASSERT_EQ(std::vector<int>{ 1 }, test.get()->values);
+}
+
+TEST(RCUTest, RCUReplace) {
+	rcu<std::vector<int>> test(3, 1);
+	auto old = test.get();
+	test.replace([](const std::vector<int>& v) {
+		std::vector<int> res(v);
+		res.push_back(2);
+		return res;
+	});
+	ASSERT_EQ(3u, old->size());
+	ASSERT_EQ(4u, test.get()->size());
+	ASSERT_EQ(2, test.get()->back());
+}
+
+namespace {
+	// The previous implementation: every get() does std::atomic_load on a shared_ptr
+	template<typename T>
+	class shared_ptr_rcu {
+		std::shared_ptr<const T> data;
+	public:
+		explicit shared_ptr_rcu(T val) : data(std::make_shared<T>(std::move(val))) {}
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+		std::shared_ptr<const T> get() const { return std::atomic_load(&data); }
+		void set(T val) { std::atomic_store(&data, std::shared_ptr<const T>(std::make_shared<T>(std::move(val)))); }
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+	};
+
+	// Runs fn on threads readers for duration and returns the total number of reads per second
+	template<typename Func>
+	double measure_readers(size_t threads, Func fn) {
+		std::atomic<bool> start(false), stop(false);
+		std::atomic<uint64_t> total(0);
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; t++) {
+			workers.emplace_back([&]() {
+				while (!start) std::this_thread::yield();
+				uint64_t n = 0, sum = 0;
+				while (!stop) {
+					for (int i = 0; i < 256; i++)
+						sum += fn();
+					n += 256;
+				}
+				total += n + (sum == 0 ? 1 : 0);
+			});
+		}
+		const auto begin = std::chrono::steady_clock::now();
+		start = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		stop = true;
+		for (auto& w : workers) w.join();
+		const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		return static_cast<double>(total.load()) / secs;
+	}
+}
+
+// Reader throughput vs thread count, run with --gtest_also_run_disabled_tests --gtest_filter='*Benchmark*'
+TEST(RCUTest, DISABLED_BenchmarkReaderScaling) {
+	rcu<std::vector<int>> epoch_rcu(16, 1);
+	shared_ptr_rcu<std::vector<int>> old_rcu(std::vector<int>(16, 1));
+	const size_t max_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+	std::printf("%8s %16s %16s %16s\n", "threads", "atomic_load/s", "get()/s", "read_lock()/s");
+	for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+		const auto old_rate = measure_readers(threads, [&]() { return old_rcu.get()->size(); });
+		const auto get_rate = measure_readers(threads, [&]() { return epoch_rcu.get()->size(); });
+		const auto guard_rate = measure_readers(threads, [&]() { return epoch_rcu.read_lock()->size(); });
+		std::printf("%8zu %16.0f %16.0f %16.0f\n", threads, old_rate, get_rate, guard_rate);
+	}
+}
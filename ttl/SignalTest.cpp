@@ -1,7 +1,15 @@
 #include <gtest/gtest.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
 #include "ttl/signal.h"
 #include "ttl/noop_mutex.h"
+#include "ttl/async_signal.h"
 
 
 TEST(SignalTest, Executed) {
@@ -66,3 +74,254 @@ TEST(SignalTest, TokenCleared) {
 	sig();
 	ASSERT_FALSE(executed);
 }
+
+TEST(SignalTest, ModifyWhileInvoking) {
+	int first = 0;
+	int second = 0;
+
+	ttl::signal<> sig;
+	std::shared_ptr<void> token2;
+	auto token1 = sig.add([&]() {
+		first++;
+		// Adding delegates from a handler only affects later emissions, removing takes effect immediately
+		if (first == 1)
+			token2 = sig.add([&]() { second++; });
+		else if (first == 3)
+			token2.reset();
+	});
+	sig();
+	ASSERT_EQ(1, first);
+	ASSERT_EQ(0, second);
+	sig();
+	ASSERT_EQ(2, first);
+	ASSERT_EQ(1, second);
+	sig();
+	ASSERT_EQ(3, first);
+	ASSERT_EQ(1, second);
+}
+
+TEST(SignalTest, ReleaseWaitsForRunningHandler) {
+	std::atomic<bool> entered(false);
+	std::atomic<bool> left(false);
+	std::atomic<bool> released(false);
+	std::atomic<int> entered_after(0);
+
+	ttl::signal<> sig;
+	auto token = sig.add([&]() {
+		if (released)
+			entered_after++;
+		entered = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		left = true;
+	});
+	std::thread emitter([&sig]() { sig(); });
+	while (!entered)
+		std::this_thread::yield();
+	token.reset();
+	released = true;
+	// The owner of the captures may be destroyed now
+	ASSERT_TRUE(left);
+	std::thread later([&sig]() {
+		for (int i = 0; i < 100; i++)
+			sig();
+	});
+	later.join();
+	emitter.join();
+	ASSERT_EQ(0, entered_after);
+}
+
+TEST(SignalTest, ReleaseInsideHandler) {
+	int executed = 0;
+
+	ttl::signal<> sig;
+	std::shared_ptr<void> token;
+	token = sig.add([&]() {
+		executed++;
+		// Must not wait for the running call
+		token.reset();
+	});
+	sig();
+	sig();
+	ASSERT_EQ(1, executed);
+}
+
+TEST(SignalTest, MutableHandlerState) {
+	std::vector<int> values;
+	std::shared_ptr<void> other;
+	int count = 0;
+
+	ttl::signal<> sig;
+	// The handler exists once, so state changed after the array was copied by add() is kept
+	auto token = sig.add([&values, &other, &sig, count]() mutable {
+		if (!other)
+			other = sig.add([]() {});
+		count++;
+		values.push_back(count);
+	});
+	sig();
+	sig();
+	ASSERT_EQ((std::vector<int>{ 1, 2 }), values);
+}
+
+TEST(SignalTest, ConcurrentInvoke) {
+	std::atomic<int> count(0);
+
+	ttl::signal<int> sig;
+	auto token = sig.add([&count](int v) { count += v; });
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&sig]() {
+			for (int i = 0; i < 1000; i++)
+				sig(1);
+		});
+	}
+	// Connect and disconnect while the other threads emit
+	for (int i = 0; i < 100; i++) {
+		auto tmp = sig.add([](int) {});
+	}
+	for (auto& t : threads)
+		t.join();
+	ASSERT_EQ(4000, count);
+}
+
+TEST(SignalTest, LargeCapture) {
+	// Too large for the inline buffer of a delegate
+	std::array<int, 32> values;
+	for (size_t i = 0; i < values.size(); i++)
+		values[i] = static_cast<int>(i);
+	int sum = 0;
+
+	ttl::signal<int> sig;
+	auto token = sig.add([values, &sum](int factor) {
+		for (auto v : values)
+			sum += v * factor;
+	});
+	auto small = sig.add([&sum](int) { sum++; });
+	// Copying the delegate array needs to keep both alive
+	auto tmp = sig.add([](int) {});
+	tmp.reset();
+	sig(2);
+	ASSERT_EQ(31 * 32 + 1, sum);
+}
+
+TEST(SignalTest, AsyncQueue) {
+	std::mutex mtx;
+	std::vector<int> values;
+	std::vector<std::string> strings;
+	std::atomic<std::thread::id> handler_thread;
+
+	ttl::async_signal<int, const std::string&> sig;
+	auto token = sig.add([&](int v, const std::string& str) {
+		std::unique_lock<std::mutex> lck(mtx);
+		handler_thread = std::this_thread::get_id();
+		values.push_back(v);
+		strings.push_back(str);
+	});
+	for (int i = 0; i < 100; i++) {
+		// The argument only needs to live until invoke returns
+		sig(i, std::to_string(i));
+	}
+	sig.flush();
+
+	std::unique_lock<std::mutex> lck(mtx);
+	ASSERT_EQ(100u, values.size());
+	for (int i = 0; i < 100; i++) {
+		ASSERT_EQ(i, values[i]);
+		ASSERT_EQ(std::to_string(i), strings[i]);
+	}
+	ASSERT_NE(std::this_thread::get_id(), handler_thread.load());
+}
+
+TEST(SignalTest, AsyncBatchExecutor) {
+	std::vector<std::function<void()>> jobs;
+	std::vector<size_t> batches;
+	int sum = 0;
+
+	{
+		ttl::async_signal<int> sig([&jobs](std::function<void()> fn) { jobs.push_back(std::move(fn)); });
+		auto batch = sig.add_batch([&](const std::vector<std::tuple<int>>& values) {
+			batches.push_back(values.size());
+			for (auto& v : values)
+				sum += std::get<0>(v);
+		});
+		sig(1);
+		sig(2);
+		sig(3);
+		// Only one job is posted until it runs
+		ASSERT_EQ(1u, jobs.size());
+		jobs[0]();
+		ASSERT_EQ(1u, batches.size());
+		ASSERT_EQ(3u, batches[0]);
+		ASSERT_EQ(6, sum);
+		sig(4);
+		ASSERT_EQ(2u, jobs.size());
+		jobs[1]();
+		ASSERT_EQ(10, sum);
+	}
+}
+
+TEST(SignalTest, AsyncCoalesce) {
+	std::vector<std::function<void()>> jobs;
+	std::vector<int> values;
+
+	ttl::async_signal<int> sig([&jobs](std::function<void()> fn) { jobs.push_back(std::move(fn)); }, ttl::async_signal<int>::mode::coalesce);
+	auto token = sig.add([&](int v) { values.push_back(v); });
+	for (int i = 0; i < 10; i++)
+		sig(i);
+	ASSERT_EQ(1u, jobs.size());
+	jobs[0]();
+	ASSERT_EQ(std::vector<int>{ 9 }, values);
+	sig.flush();
+}
+
+TEST(SignalTest, AsyncThrowingHandler) {
+	std::atomic<int> delivered(0);
+	std::atomic<int> exceptions(0);
+
+	ttl::async_signal<int> sig;
+	sig.set_exception_handler([&](std::exception_ptr) { exceptions++; });
+	auto token = sig.add([&](int v) {
+		delivered++;
+		if (v % 2)
+			throw std::runtime_error("odd");
+	});
+	for (int i = 0; i < 10; i++)
+		sig(i);
+	sig.flush();
+	// The dispatcher thread keeps running after a handler threw
+	ASSERT_EQ(10, delivered);
+	ASSERT_EQ(5, exceptions);
+	sig(10);
+	sig.flush();
+	ASSERT_EQ(11, delivered);
+}
+
+TEST(SignalTest, AsyncThrowingHandlerExecutor) {
+	std::vector<std::function<void()>> jobs;
+	int delivered = 0;
+
+	{
+		ttl::async_signal<int> sig([&jobs](std::function<void()> fn) { jobs.push_back(std::move(fn)); });
+		auto token = sig.add([&](int) {
+			delivered++;
+			throw std::runtime_error("handler");
+		});
+		auto batch = sig.add_batch([](const std::vector<std::tuple<int>>&) {
+			throw std::runtime_error("batch");
+		});
+		// Without an exception handler the exceptions are dropped
+		sig(1);
+		sig(2);
+		ASSERT_EQ(1u, jobs.size());
+		jobs[0]();
+		ASSERT_EQ(2, delivered);
+		// The job finished, so the next emission posts a new one
+		sig(3);
+		ASSERT_EQ(2u, jobs.size());
+		jobs[1]();
+		ASSERT_EQ(3, delivered);
+		sig.flush();
+	}
+	// The destructor did not wait for a job that never finished
+	ASSERT_EQ(2u, jobs.size());
+}
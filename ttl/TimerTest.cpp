@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
 #include "ttl/timer.h"
 
 using ttl::timer;
@@ -46,3 +51,282 @@ TEST(TimerTest, CatchException) {
 		}
 	}
 }
+
+TEST(TimerTest, ExecutionOrder) {
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::vector<int> order;
+	const int count = 200;
+
+	timer t;
+	std::vector<timer::token_t> tokens;
+	const auto start = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+	for (int i = 0; i < count; i++) {
+		// Insert deadlines in scrambled order
+		const int slot = (i * 37) % count;
+		tokens.push_back(t.schedule([&, slot]() {
+			std::unique_lock<std::mutex> lck(mtx);
+			order.push_back(slot);
+			cv.notify_all();
+		}, start + std::chrono::microseconds(slot * 100)));
+	}
+	// Cancel every tenth timer
+	for (int i = 0; i < count; i += 10)
+		t.clear(tokens[i]);
+	t.clear(tokens[0]);
+
+	std::unique_lock<std::mutex> lck(mtx);
+	ASSERT_TRUE(cv.wait_until(lck, std::chrono::steady_clock::now() + std::chrono::seconds(2), [&]() { return order.size() == count - count / 10; }));
+	ASSERT_TRUE(std::is_sorted(order.begin(), order.end()));
+	for (int i = 0; i < count; i += 10)
+		ASSERT_EQ(order.end(), std::find(order.begin(), order.end(), (i * 37) % count));
+}
+
+TEST(TimerTest, Resolution) {
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::vector<std::chrono::steady_clock::time_point> fired;
+
+	timer t(std::chrono::milliseconds(20));
+	// All deadlines are rounded up to the same multiple of the resolution
+	const auto res = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(20));
+	const auto now = std::chrono::steady_clock::now() + std::chrono::milliseconds(40);
+	const auto boundary = std::chrono::steady_clock::time_point(now.time_since_epoch() - now.time_since_epoch() % res + res);
+	for (int i = 1; i <= 3; i++) {
+		t.schedule([&]() {
+			std::unique_lock<std::mutex> lck(mtx);
+			fired.push_back(std::chrono::steady_clock::now());
+			cv.notify_all();
+		}, boundary - std::chrono::milliseconds(i * 5));
+	}
+
+	std::unique_lock<std::mutex> lck(mtx);
+	ASSERT_TRUE(cv.wait_until(lck, std::chrono::steady_clock::now() + std::chrono::seconds(1), [&]() { return fired.size() == 3; }));
+	for (auto& tp : fired)
+		ASSERT_GE(tp, boundary);
+}
+
+TEST(TimerTest, Workers) {
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool fast_done = false;
+	std::atomic<bool> slow_done(false);
+
+	timer t(std::chrono::nanoseconds(0), 2);
+	ASSERT_EQ(2u, t.get_worker_count());
+	auto slow = t.schedule([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		slow_done = true;
+	}, std::chrono::milliseconds(5));
+	auto fast = t.schedule([&]() {
+		std::unique_lock<std::mutex> lck(mtx);
+		fast_done = true;
+		cv.notify_all();
+	}, std::chrono::milliseconds(20));
+
+	{	// The slow handler must not delay the fast one
+		std::unique_lock<std::mutex> lck(mtx);
+		ASSERT_TRUE(cv.wait_until(lck, std::chrono::steady_clock::now() + std::chrono::seconds(1), [&]() { return fast_done; }));
+		ASSERT_FALSE(slow_done);
+	}
+
+	const auto stats = t.get_stats(fast);
+	ASSERT_EQ(1u, stats.executions);
+	ASSERT_GE(stats.max_lateness.count(), 0);
+	ASSERT_EQ(stats.last_lateness, stats.average_lateness());
+
+	const auto empty = t.get_stats(timer::token_t());
+	ASSERT_EQ(0u, empty.executions);
+	ASSERT_EQ(std::chrono::nanoseconds(0), empty.max_lateness);
+}
+
+TEST(TimerTest, ClearWhileWorkersBusy) {
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool release = false;
+	std::atomic<int> executed(0);
+
+	timer t(std::chrono::nanoseconds(0), 1);
+	t.schedule([&]() {
+		std::unique_lock<std::mutex> lck(mtx);
+		cv.wait(lck, [&]() { return release; });
+	}, std::chrono::milliseconds(1));
+	auto cleared = t.schedule([&]() { executed++; }, std::chrono::milliseconds(5));
+	t.schedule([&]() { executed++; }, std::chrono::milliseconds(5));
+	// Both tasks expired and wait behind the blocked worker
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	t.clear(cleared);
+	{
+		std::unique_lock<std::mutex> lck(mtx);
+		release = true;
+		cv.notify_all();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	ASSERT_EQ(1, executed);
+	ASSERT_EQ(0u, t.get_stats(cleared).executions);
+
+	// Same for tasks dropped by clear_all
+	{
+		std::unique_lock<std::mutex> lck(mtx);
+		release = false;
+	}
+	t.schedule([&]() {
+		std::unique_lock<std::mutex> lck(mtx);
+		cv.wait(lck, [&]() { return release; });
+	}, std::chrono::milliseconds(1));
+	t.schedule([&]() { executed++; }, std::chrono::milliseconds(5));
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	t.clear_all();
+	{
+		std::unique_lock<std::mutex> lck(mtx);
+		release = true;
+		cv.notify_all();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	ASSERT_EQ(1, executed);
+}
+
+TEST(TimerTest, Executor) {
+	std::mutex mtx;
+	std::vector<std::function<void()>> queued;
+
+	timer t;
+	t.set_executor([&](std::function<void()> fn) {
+		std::unique_lock<std::mutex> lck(mtx);
+		queued.push_back(std::move(fn));
+	});
+	std::atomic<int> executed(0);
+	t.schedule([&]() { executed++; }, std::chrono::milliseconds(1));
+	t.schedule([&]() { executed++; }, std::chrono::milliseconds(2));
+
+	const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (std::chrono::steady_clock::now() < end) {
+		std::unique_lock<std::mutex> lck(mtx);
+		if (queued.size() == 2)
+			break;
+		lck.unlock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::unique_lock<std::mutex> lck(mtx);
+	ASSERT_EQ(2u, queued.size());
+	ASSERT_EQ(0, executed);
+	for (auto& fn : queued)
+		fn();
+	ASSERT_EQ(2, executed);
+	ASSERT_EQ(2u, t.get_stats().executions);
+}
+
+namespace {
+	// Run a periodic task whose first execution takes 175ms with a period of 50ms and return the start times
+	std::vector<std::chrono::steady_clock::time_point> run_periodic(timer::periodic_policy policy, std::chrono::steady_clock::time_point first, size_t count) {
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::vector<std::chrono::steady_clock::time_point> times;
+
+		timer t;
+		auto token = t.schedule([&]() {
+			std::unique_lock<std::mutex> lck(mtx);
+			times.push_back(std::chrono::steady_clock::now());
+			cv.notify_all();
+			if (times.size() == 1) {
+				lck.unlock();
+				std::this_thread::sleep_for(std::chrono::milliseconds(175));
+			}
+		}, timer::every(std::chrono::milliseconds(50), policy), first);
+
+		std::unique_lock<std::mutex> lck(mtx);
+		cv.wait_until(lck, std::chrono::steady_clock::now() + std::chrono::seconds(2), [&]() { return times.size() >= count; });
+		t.clear(token);
+		return times;
+	}
+}
+
+TEST(TimerTest, PeriodicDefault) {
+	// Rescheduled one period after the slow run started, so the next run follows right after it
+	ASSERT_EQ(timer::periodic_policy::fixed_start, timer::every(std::chrono::milliseconds(50)).get_policy());
+	const auto first = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+	auto times = run_periodic(timer::periodic_policy::fixed_start, first, 3);
+	ASSERT_GE(times.size(), 3u);
+	ASSERT_GE(times[1] - times[0], std::chrono::milliseconds(175));
+	ASSERT_LT(times[1] - times[0], std::chrono::milliseconds(215));
+	ASSERT_GE(times[2] - times[1], std::chrono::milliseconds(50));
+}
+
+TEST(TimerTest, PeriodicFixedDelay) {
+	const auto first = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+	auto times = run_periodic(timer::periodic_policy::fixed_delay, first, 2);
+	ASSERT_GE(times.size(), 2u);
+	ASSERT_GE(times[1] - times[0], std::chrono::milliseconds(225));
+}
+
+TEST(TimerTest, PeriodicCatchUp) {
+	const auto first = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+	auto times = run_periodic(timer::periodic_policy::catch_up, first, 5);
+	ASSERT_GE(times.size(), 5u);
+	// The runs due at 50, 100 and 150ms are executed right after the slow first one
+	ASSERT_LT(times[1], first + std::chrono::milliseconds(200));
+	ASSERT_LT(times[3] - times[1], std::chrono::milliseconds(40));
+	// Afterwards the original schedule continues
+	ASSERT_GE(times[4], first + std::chrono::milliseconds(200));
+}
+
+TEST(TimerTest, PeriodicSkip) {
+	const auto first = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+	auto times = run_periodic(timer::periodic_policy::skip, first, 3);
+	ASSERT_GE(times.size(), 3u);
+	ASSERT_GE(times[1], first + std::chrono::milliseconds(200));
+	ASSERT_GE(times[2], first + std::chrono::milliseconds(250));
+}
+
+TEST(TimerTest, PeriodicClearWhileRunning) {
+	std::atomic<int> executed(0);
+	std::mutex mtx;
+	timer::token_t token;
+
+	timer t;
+	{
+		std::unique_lock<std::mutex> lck(mtx);
+		token = t.schedule([&]() {
+			executed++;
+			std::unique_lock<std::mutex> lck(mtx);
+			t.clear(token);
+		}, timer::every(std::chrono::milliseconds(5)));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	ASSERT_EQ(1, executed);
+	ASSERT_EQ(1u, t.get_stats(token).executions);
+	ASSERT_EQ(std::chrono::nanoseconds(0), t.get_stats(token).jitter());
+}
+
+// Heap operations with 1M pending timers, run with --gtest_also_run_disabled_tests --gtest_filter='*BenchmarkMillionTimers*'
+TEST(TimerTest, DISABLED_BenchmarkMillionTimers) {
+	const size_t count = 1000000;
+	std::vector<timer::token_t> tokens(count);
+	std::atomic<size_t> executed(0);
+	auto ns_per_op = [count](std::chrono::steady_clock::time_point begin) {
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / static_cast<double>(count);
+	};
+
+	timer t;
+	// Deadlines far in the future, in an order that does not match the deadlines
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++)
+		tokens[i] = t.schedule([]() {}, std::chrono::hours(1) + std::chrono::microseconds((i * 7919) % count));
+	std::printf("%-10s %8.1f ns/timer\n", "schedule", ns_per_op(begin));
+
+	std::reverse(tokens.begin(), tokens.end());
+	begin = std::chrono::steady_clock::now();
+	for (auto& token : tokens)
+		t.clear(token);
+	std::printf("%-10s %8.1f ns/timer\n", "clear", ns_per_op(begin));
+
+	// All timers expire within 100ms, starting after they were scheduled
+	const auto first = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	for (size_t i = 0; i < count; i++)
+		tokens[i] = t.schedule([&executed]() { executed++; }, first + std::chrono::nanoseconds((i * 7919) % count * 100));
+	while (executed != count)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::printf("%-10s %8.1f ns/timer (average lateness %lld us)\n", "expire", ns_per_op(first),
+		static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(t.get_stats().average_lateness()).count()));
+	ASSERT_EQ(count, t.get_stats().executions);
+}
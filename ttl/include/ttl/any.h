@@ -3,6 +3,8 @@
 #include "type.h"
 #include "to_string.h"
 #include <functional>
+#include <new>
+#include <type_traits>
 #include "cxx11_helpers.h"
 #ifdef __cpp_lib_any
 #include <any>
@@ -51,17 +53,22 @@ namespace ttl
 		};
 	}
 	class any {
+		// Inline storage, fits the data header (vtable) plus four pointers (e.g. a std::string)
+		typedef std::aligned_storage<5 * sizeof(void*), alignof(void*)>::type storage_t;
+
+		template<typename T>
+		struct fits_inline;
+
 		class data_base {
-			ttl::type type_info;
-		protected:
-			explicit data_base(ttl::type info)
-				:type_info(info)
-			{}
 		public:
 			virtual ~data_base() noexcept {}
-			const ttl::type& type() const noexcept { return type_info; }
+			virtual const ttl::type& type() const noexcept = 0;
 			virtual void* data_ptr() noexcept = 0;
-			virtual std::unique_ptr<data_base> clone() const = 0;
+			// Copy into buf if the value fits, otherwise on the heap
+			virtual data_base* copy_to(void* buf) const = 0;
+			// Move into buf, only called for values stored inline
+			virtual data_base* move_to(void* buf) noexcept = 0;
+			virtual bool is_inline() const noexcept = 0;
 #ifdef __cpp_lib_any
 			virtual std::any to_std_any() const = 0;
 #endif
@@ -74,16 +81,27 @@ namespace ttl
 			T val;
 
 			explicit data(T v)
-				: data_base(type::create<T>()), val(v)
+				: val(static_cast<T&&>(v))
 			{
 			}
 
 			virtual ~data() noexcept override {}
+			// Shared by all values of this type, so storing a value does not allocate type information
+			const ttl::type& type() const noexcept override {
+				static const ttl::type info = ttl::type::create<T>();
+				return info;
+			}
 			void* data_ptr() noexcept override {
 				return const_cast<void*>(static_cast<const void*>(&val));
 			}
-			std::unique_ptr<data_base> clone() const override {
-				return ttl::make_unique<data<T>>(val);
+			data_base* copy_to(void* buf) const override {
+				return make_data<T>(buf, typename fits_inline<T>::type(), val);
+			}
+			data_base* move_to(void* buf) noexcept override {
+				return make_data<T>(buf, typename fits_inline<T>::type(), static_cast<T&&>(val));
+			}
+			bool is_inline() const noexcept override {
+				return fits_inline<T>::value;
 			}
 #ifdef __cpp_lib_any
 			std::any to_std_any() const override {
@@ -136,7 +154,53 @@ namespace ttl
 			}
 		};
 
-		std::unique_ptr<data_base> val;
+		// Small values that can be moved without throwing are stored in m_buf instead of on the heap
+		template<typename T>
+		struct fits_inline {
+			static constexpr bool value = sizeof(data<T>) <= sizeof(storage_t) && alignof(data<T>) <= alignof(storage_t)
+				&& (std::is_reference<T>::value || std::is_nothrow_move_constructible<T>::value);
+			typedef std::integral_constant<bool, value> type;
+		};
+
+		template<typename T, typename... Args>
+		static data_base* make_data(void* buf, std::true_type, Args&&... args) {
+			return new (buf) data<T>(std::forward<Args>(args)...);
+		}
+		template<typename T, typename... Args>
+		static data_base* make_data(void*, std::false_type, Args&&... args) {
+			return new data<T>(std::forward<Args>(args)...);
+		}
+
+		storage_t m_buf;
+		data_base* val;
+
+		template<typename T, typename... Args>
+		void construct(Args&&... args) {
+			val = make_data<T>(&m_buf, typename fits_inline<T>::type(), std::forward<Args>(args)...);
+		}
+
+		void destroy() noexcept {
+			if (val == nullptr)
+				return;
+			if (val->is_inline())
+				val->~data_base();
+			else
+				delete val;
+			val = nullptr;
+		}
+
+		// Take the value of other, which is left empty
+		void take(any& other) noexcept {
+			if (other.val == nullptr)
+				return;
+			if (other.val->is_inline()) {
+				val = other.val->move_to(&m_buf);
+				other.destroy();
+			} else {
+				val = other.val;
+				other.val = nullptr;
+			}
+		}
 
 #ifdef __GLIBCXX__
 		static void* upcast(const std::type_info& from, const std::type_info& to, void* ptr) {
@@ -266,25 +330,49 @@ namespace ttl
 		template<typename T>
 		static any create(T&& arg) {
 			any res;
-			res.val = ttl::make_unique<data<T>>(std::forward<T>(arg));
+			res.construct<T>(std::forward<T>(arg));
 			return res;
 		}
 		// Create with implicit type
 		template<typename T>
 		any(T arg)
-			: val(ttl::make_unique<data<T>>(std::move(arg)))
-		{}
+			: val(nullptr)
+		{
+			construct<T>(std::move(arg));
+		}
 
 		any(const any& other)
-			: val(other.val == nullptr ? nullptr : other.val->clone())
+			: val(other.val == nullptr ? nullptr : other.val->copy_to(&m_buf))
 		{}
 
+		any(any&& other) noexcept
+			: val(nullptr)
+		{
+			take(other);
+		}
+
 		// Create empty
 		any()
+			: val(nullptr)
 		{}
 
+		~any() {
+			destroy();
+		}
+
 		any& operator=(const any& other) {
-			val = other.val == nullptr ? nullptr : other.val->clone();
+			if (this != &other) {
+				any tmp(other);
+				*this = std::move(tmp);
+			}
+			return *this;
+		}
+
+		any& operator=(any&& other) noexcept {
+			if (this != &other) {
+				destroy();
+				take(other);
+			}
 			return *this;
 		}
 
@@ -319,7 +407,7 @@ namespace ttl
 		any clone() const {
 			if(empty()) throw std::logic_error("invalid any");
 			any a;
-			a.val = val->clone();
+			a.val = val->copy_to(&a.m_buf);
 			return a;
 		}
 
@@ -0,0 +1,338 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include "logger.h"
+
+namespace ttl {
+	/**
+	 * Logger that moves formatting and output of messages to a background thread.
+	 * Every logging thread gets its own single producer ring buffer, so logging never takes a lock
+	 * (except once per thread for registration). The background thread drains all rings in batches,
+	 * forwards the messages to the target logger and flushes it once per batch.
+	 * The target logger needs to outlive the async_logger.
+	 */
+	class async_logger : public logger {
+	public:
+		// What to do if the ring buffer of a thread is full
+		enum class overflow_policy {
+			// Wait until the background thread made room
+			block,
+			// Discard the message
+			drop,
+			// Discard the message and report the number of dropped messages in the output
+			count
+		};
+	private:
+		struct record {
+			loglevel level;
+			std::chrono::system_clock::time_point time;
+			std::string module;
+			std::string message;
+			// Set if the message still needs to be formatted from args
+			const char* fmt;
+			log_args args;
+		};
+
+		class ring {
+			std::vector<record> m_slots;
+			size_t m_mask;
+			// Keep producer and consumer index on separate cache lines
+			char m_pad0[64];
+			std::atomic<size_t> m_head;
+			char m_pad1[64];
+			std::atomic<size_t> m_tail;
+			char m_pad2[64];
+			// Set once the owning thread exited, the consumer removes the ring after draining it
+			std::atomic<bool> m_abandoned;
+		public:
+			explicit ring(size_t capacity)
+				: m_slots(capacity), m_mask(capacity - 1), m_head(0), m_tail(0), m_abandoned(false)
+			{}
+
+			void abandon() {
+				m_abandoned.store(true, std::memory_order_release);
+			}
+
+			// True if the owner exited and all its messages are consumed
+			bool finished() const {
+				return m_abandoned.load(std::memory_order_acquire) && empty();
+			}
+
+			bool empty() const {
+				return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+			}
+
+			bool push(loglevel l, std::chrono::system_clock::time_point tp, const std::string& module, const std::string& msg, const char* fmt, const log_args* args) {
+				const auto tail = m_tail.load(std::memory_order_relaxed);
+				if (tail - m_head.load(std::memory_order_acquire) == m_slots.size())
+					return false;
+				// Slots keep their buffer capacity, so steady state logging does not allocate
+				auto& slot = m_slots[tail & m_mask];
+				slot.level = l;
+				slot.time = tp;
+				slot.module.assign(module);
+				slot.message.assign(msg);
+				slot.fmt = fmt;
+				if (args)
+					slot.args.assign(*args);
+				m_tail.store(tail + 1, std::memory_order_release);
+				return true;
+			}
+
+			template<typename Func>
+			size_t consume(Func&& fn) {
+				auto head = m_head.load(std::memory_order_relaxed);
+				const auto tail = m_tail.load(std::memory_order_acquire);
+				const size_t res = tail - head;
+				for (; head != tail; head++) {
+					fn(m_slots[head & m_mask]);
+				}
+				m_head.store(head, std::memory_order_release);
+				return res;
+			}
+		};
+
+		logger& m_target;
+		const uint64_t m_id;
+		const size_t m_ring_size;
+		const overflow_policy m_policy;
+		const std::chrono::milliseconds m_interval;
+
+		std::mutex m_rings_mtx;
+		std::vector<std::shared_ptr<ring>> m_rings;
+		std::atomic<bool> m_rings_changed;
+
+		std::mutex m_mtx;
+		std::condition_variable m_cv;
+		std::condition_variable m_flush_cv;
+		std::atomic<bool> m_sleeping;
+		std::atomic<bool> m_exit;
+		std::atomic<uint64_t> m_flush_requested;
+		uint64_t m_flush_done;
+		std::atomic<uint64_t> m_dropped;
+		std::atomic<uint64_t> m_dropped_unreported;
+		std::thread m_thread;
+
+		static uint64_t next_id() {
+			static std::atomic<uint64_t> id(0);
+			return ++id;
+		}
+
+		static size_t round_capacity(size_t size) {
+			size_t res = 2;
+			while (res < size)
+				res <<= 1;
+			return res;
+		}
+
+		ring& get_ring() {
+			struct entry {
+				uint64_t id;
+				std::weak_ptr<ring> buffer;
+			};
+			// Hands the rings of an exiting thread over to the consumers for removal
+			struct thread_rings : std::vector<entry> {
+				~thread_rings() {
+					for (auto& e : *this) {
+						auto r = e.buffer.lock();
+						if (r) r->abandon();
+					}
+				}
+			};
+			static thread_local thread_rings rings;
+			for (auto& e : rings) {
+				if (e.id == m_id) {
+					auto res = e.buffer.lock();
+					// The logger (and therefore this) keeps the ring alive
+					if (res) return *res;
+				}
+			}
+			auto res = std::make_shared<ring>(m_ring_size);
+			for (auto it = rings.begin(); it != rings.end();) {
+				if (it->buffer.expired())
+					it = rings.erase(it);
+				else it++;
+			}
+			rings.push_back({ m_id, res });
+			{
+				std::unique_lock<std::mutex> lck(m_rings_mtx);
+				m_rings.push_back(res);
+				m_rings_changed = true;
+			}
+			return *res;
+		}
+
+		void wakeup() {
+			if (m_sleeping.exchange(false)) {
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_cv.notify_one();
+			}
+		}
+
+		void enqueue(loglevel l, const std::string& module, const std::string& message, const char* fmt, const log_args* args)
+		{
+			auto& buf = get_ring();
+			const auto now = std::chrono::system_clock::now();
+			while (!buf.push(l, now, module, message, fmt, args)) {
+				if (m_policy != overflow_policy::block) {
+					m_dropped++;
+					m_dropped_unreported++;
+					return;
+				}
+				wakeup();
+				std::this_thread::yield();
+			}
+			wakeup();
+		}
+
+		void write(loglevel l, const std::string& module, const std::string& message) override
+		{
+			enqueue(l, module, message, nullptr, nullptr);
+		}
+
+		// Formatting is done by the background thread
+		void write_args(loglevel l, const std::string& module, const char* fmt, const log_args& args) override
+		{
+			static const std::string empty;
+			enqueue(l, module, empty, fmt, &args);
+		}
+
+		// Remove rings of exited threads, so thread churn does not grow the list scanned by the consumer
+		void remove_finished(std::vector<std::shared_ptr<ring>>& rings) {
+			bool found = false;
+			for (auto& r : rings) {
+				if (r->finished()) {
+					found = true;
+					break;
+				}
+			}
+			if (!found)
+				return;
+			std::unique_lock<std::mutex> lck(m_rings_mtx);
+			m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(), [](const std::shared_ptr<ring>& r) {
+				return r->finished();
+			}), m_rings.end());
+			rings = m_rings;
+		}
+
+		void thread_fn() {
+			std::vector<std::shared_ptr<ring>> rings;
+			std::string message;
+			while (true) {
+				const auto flush_req = m_flush_requested.load(std::memory_order_acquire);
+				const bool exit = m_exit.load(std::memory_order_acquire);
+				if (m_rings_changed.exchange(false)) {
+					std::unique_lock<std::mutex> lck(m_rings_mtx);
+					rings = m_rings;
+				}
+				size_t written = 0;
+				for (auto& r : rings) {
+					written += r->consume([this, &message](const record& rec) {
+						// Only format messages the target wants
+						if (!m_target.is_forward_enabled(rec.level, rec.module))
+							return;
+						const std::string* msg = &rec.message;
+						if (rec.fmt != nullptr) {
+							message.clear();
+							rec.args.format_to(message, rec.fmt);
+							msg = &message;
+						}
+						if (m_target.passes_check(rec.level, rec.module, *msg))
+							m_target.write_at(rec.level, rec.module, *msg, rec.time);
+					});
+				}
+				remove_finished(rings);
+				if (m_policy == overflow_policy::count) {
+					auto dropped = m_dropped_unreported.exchange(0);
+					if (dropped != 0) {
+						// Not filtered by the target, losing messages should always be visible
+						m_target.write_at(loglevel::WARN, "async_logger", "dropped " + std::to_string(dropped) + " messages", std::chrono::system_clock::now());
+						written++;
+					}
+				}
+				if (written != 0 || flush_req != m_flush_done)
+					m_target.flush();
+				if (flush_req != m_flush_done) {
+					std::unique_lock<std::mutex> lck(m_mtx);
+					m_flush_done = flush_req;
+					m_flush_cv.notify_all();
+				}
+				if (exit)
+					break;
+				if (written != 0)
+					continue;
+
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_sleeping = true;
+				bool pending = false;
+				for (auto& r : rings) {
+					if (!r->empty()) {
+						pending = true;
+						break;
+					}
+				}
+				if (!pending && !m_rings_changed) {
+					m_cv.wait_for(lck, m_interval, [&]() {
+						return !m_sleeping || m_exit || m_flush_requested != flush_req;
+					});
+				}
+				m_sleeping = false;
+			}
+		}
+	public:
+		/**
+		 * target: logger receiving the messages on the background thread
+		 * ring_size: number of messages each thread can queue, rounded up to a power of two
+		 * interval: maximum time the background thread sleeps before checking for new messages
+		 */
+		explicit async_logger(logger& target, loglevel level = loglevel::INFO, overflow_policy policy = overflow_policy::block,
+			size_t ring_size = 1024, std::chrono::milliseconds interval = std::chrono::milliseconds(50))
+			: logger(level), m_target(target), m_id(next_id()), m_ring_size(round_capacity(ring_size)), m_policy(policy), m_interval(interval),
+			m_rings_changed(false), m_sleeping(false), m_exit(false), m_flush_requested(0), m_flush_done(0), m_dropped(0), m_dropped_unreported(0)
+		{
+			m_thread = std::thread(&async_logger::thread_fn, this);
+		}
+
+		~async_logger() {
+			m_exit = true;
+			{
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_sleeping = false;
+				m_cv.notify_all();
+			}
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+
+		// Wait until all messages logged before this call are written and the target is flushed
+		void flush() override {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			const auto req = ++m_flush_requested;
+			m_sleeping = false;
+			m_cv.notify_all();
+			m_flush_cv.wait(lck, [&]() { return m_flush_done >= req; });
+		}
+
+		overflow_policy get_overflow_policy() const { return m_policy; }
+
+		// Number of per thread ring buffers, rings of exited threads are removed once they are drained
+		size_t get_ring_count() {
+			std::unique_lock<std::mutex> lck(m_rings_mtx);
+			return m_rings.size();
+		}
+
+		// Total number of messages dropped because a ring buffer was full
+		uint64_t get_dropped_count() const { return m_dropped; }
+	};
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
@@ -0,0 +1,304 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <tuple>
+#include <functional>
+#include <exception>
+#include <type_traits>
+#include <new>
+#include "signal.h"
+#include "noncopyable.h"
+#include "cxx11_helpers.h"
+
+namespace ttl {
+	/**
+	 * Signal delivering emissions asynchronously on a dispatcher thread or an executor.
+	 * Emitting only pushes the arguments into a lock free queue, so producers are never blocked by handlers.
+	 * Handlers added with add() are called once per emission, handlers added with add_batch() get all
+	 * emissions collected since the last delivery at once.
+	 * Arguments are stored by value (decayed), so references passed to invoke() do not need to stay valid.
+	 * Exceptions thrown by handlers are passed to the exception handler, or dropped if none is set.
+	 */
+	template<typename... Args>
+	class async_signal : public noncopyable {
+	public:
+		typedef std::tuple<typename std::decay<Args>::type...> value_type;
+		// Runs the passed function, needs to run all functions before the async_signal is destroyed
+		typedef std::function<void(std::function<void()>)> executor_fn_t;
+		typedef std::function<void(std::exception_ptr)> exception_fn_t;
+
+		enum class mode {
+			// Every emission is delivered
+			queue,
+			// Only the latest pending emission is delivered (last value wins)
+			coalesce
+		};
+	private:
+		// Node of an intrusive multi producer single consumer queue
+		struct node {
+			std::atomic<node*> next;
+			typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage;
+
+			node() : next(nullptr) {}
+			value_type& value() { return *reinterpret_cast<value_type*>(&storage); }
+		};
+
+		const mode m_mode;
+		const executor_fn_t m_executor;
+		exception_fn_t m_exception_handler;
+
+		// Producers push at m_head, the consumer pops at m_tail (m_tail is the stub, its value is already taken)
+		std::atomic<node*> m_head;
+		node* m_tail;
+		// Pending value in coalesce mode
+		std::atomic<node*> m_latest;
+
+		signal<Args...> m_handlers;
+		signal<const std::vector<value_type>&> m_batch_handlers;
+		std::vector<value_type> m_batch;
+
+		std::atomic<bool> m_scheduled;
+		std::atomic<size_t> m_jobs;
+		std::atomic<uint64_t> m_emitted;
+		std::atomic<uint64_t> m_delivered;
+		mutable std::mutex m_mtx;
+		std::condition_variable m_cv;
+		std::condition_variable m_flush_cv;
+		bool m_exit;
+		std::thread m_thread;
+
+		template<typename... T>
+		static node* make_node(T&&... args) {
+			auto n = new node();
+			new (&n->storage) value_type(std::forward<T>(args)...);
+			return n;
+		}
+
+		static void free_node(node* n) {
+			n->value().~value_type();
+			delete n;
+		}
+
+		void push(node* n) {
+			auto prev = m_head.exchange(n);
+			prev->next.store(n);
+		}
+
+		// Move all queued values into m_batch, only called by the consumer
+		void collect() {
+			if (m_mode == mode::coalesce) {
+				auto n = m_latest.exchange(nullptr);
+				if (n) {
+					m_batch.push_back(std::move(n->value()));
+					free_node(n);
+				}
+				return;
+			}
+			while (true) {
+				auto next = m_tail->next.load();
+				if (next == nullptr)
+					break;
+				m_batch.push_back(std::move(next->value()));
+				next->value().~value_type();
+				// The old stub has no value anymore
+				delete m_tail;
+				m_tail = next;
+			}
+		}
+
+		template<size_t... I>
+		void deliver(value_type& v, index_sequence<I...>) {
+			try {
+				m_handlers.invoke(std::get<I>(v)...);
+			}
+			catch (...) {
+				handle_exception();
+			}
+		}
+
+		void deliver_batch() {
+			try {
+				m_batch_handlers.invoke(m_batch);
+			}
+			catch (...) {
+				handle_exception();
+			}
+		}
+
+		// Called from a catch block, the remaining emissions are still delivered
+		void handle_exception() {
+			auto handler = get_exception_handler();
+			if (handler)
+				handler(std::current_exception());
+		}
+
+		void drain() {
+			collect();
+			if (m_batch.empty())
+				return;
+			deliver_batch();
+			for (auto& v : m_batch)
+				deliver(v, make_index_sequence<sizeof...(Args)>());
+			const auto n = m_batch.size();
+			m_batch.clear();
+			m_delivered.fetch_add(n, std::memory_order_release);
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_flush_cv.notify_all();
+		}
+
+		// Decrements a counter or clears a flag when leaving the scope, even if an exception is thrown
+		struct job_guard {
+			std::atomic<size_t>& jobs;
+			~job_guard() { jobs--; }
+		};
+		struct scheduled_guard {
+			std::atomic<bool>& scheduled;
+			~scheduled_guard() { scheduled.store(false); }
+		};
+
+		void wakeup() {
+			if (m_scheduled.exchange(true))
+				return;
+			if (m_executor) {
+				m_jobs++;
+				m_executor([this]() {
+					job_guard job{ m_jobs };
+					// m_scheduled stays set while draining, so no second job is posted.
+					// Afterwards check for emissions that arrived after the last collect.
+					do {
+						scheduled_guard scheduled{ m_scheduled };
+						drain();
+					} while (has_pending() && !m_scheduled.exchange(true));
+				});
+			} else {
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_cv.notify_one();
+			}
+		}
+
+		bool has_pending() const {
+			if (m_mode == mode::coalesce)
+				return m_latest.load() != nullptr;
+			return m_tail->next.load() != nullptr;
+		}
+
+		void thread_fn() {
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lck(m_mtx);
+					m_cv.wait(lck, [this]() { return m_exit || m_scheduled.load(); });
+				}
+				m_scheduled.exchange(false);
+				drain();
+				std::unique_lock<std::mutex> lck(m_mtx);
+				if (m_exit && !has_pending())
+					break;
+			}
+		}
+
+		void init() {
+			auto stub = new node();
+			m_head = stub;
+			m_tail = stub;
+			if (!m_executor)
+				m_thread = std::thread(&async_signal::thread_fn, this);
+		}
+	public:
+		// Deliver emissions on a dedicated dispatcher thread
+		explicit async_signal(mode m = mode::queue)
+			: m_mode(m), m_latest(nullptr), m_scheduled(false), m_jobs(0), m_emitted(0), m_delivered(0), m_exit(false)
+		{
+			init();
+		}
+
+		// Deliver emissions by posting a drain job to executor, at most one job is pending at any time
+		explicit async_signal(executor_fn_t executor, mode m = mode::queue)
+			: m_mode(m), m_executor(std::move(executor)), m_latest(nullptr), m_scheduled(false), m_jobs(0), m_emitted(0), m_delivered(0), m_exit(false)
+		{
+			init();
+		}
+
+		// Pending emissions are delivered before the destructor returns
+		~async_signal() {
+			if (m_executor) {
+				while (m_jobs.load() != 0)
+					std::this_thread::yield();
+				drain();
+			} else {
+				{
+					std::unique_lock<std::mutex> lck(m_mtx);
+					m_exit = true;
+					m_cv.notify_all();
+				}
+				m_thread.join();
+			}
+			auto n = m_latest.exchange(nullptr);
+			if (n)
+				free_node(n);
+			delete m_tail;
+		}
+
+		template<typename Func>
+		std::shared_ptr<void> add(Func f) {
+			return m_handlers.add(f);
+		}
+
+		template<typename Func>
+		std::shared_ptr<void> operator+=(Func f) {
+			return m_handlers.add(f);
+		}
+
+		// Add a handler receiving all emissions collected since the last delivery as const std::vector<value_type>&
+		template<typename Func>
+		std::shared_ptr<void> add_batch(Func f) {
+			return m_batch_handlers.add(f);
+		}
+
+		void invoke(Args... args) {
+			auto n = make_node(std::forward<Args>(args)...);
+			m_emitted.fetch_add(1, std::memory_order_relaxed);
+			if (m_mode == mode::coalesce) {
+				auto old = m_latest.exchange(n);
+				if (old) {
+					// Replaced before it was delivered
+					free_node(old);
+					m_delivered.fetch_add(1, std::memory_order_release);
+				}
+			} else {
+				push(n);
+			}
+			wakeup();
+		}
+
+		void operator()(Args... args) {
+			invoke(std::forward<Args>(args)...);
+		}
+
+		// Wait until all emissions made before this call are delivered, must not be called from a handler
+		void flush() {
+			const auto emitted = m_emitted.load();
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_flush_cv.wait(lck, [&]() { return m_delivered.load(std::memory_order_acquire) >= emitted; });
+		}
+
+		mode get_mode() const { return m_mode; }
+
+		void set_exception_handler(exception_fn_t fn) {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_exception_handler = fn;
+		}
+
+		exception_fn_t get_exception_handler() const {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			return m_exception_handler;
+		}
+	};
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
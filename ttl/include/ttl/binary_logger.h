@@ -0,0 +1,136 @@
+#pragma once
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include "logger.h"
+#include "binary_reader.h"
+#include "binary_writer.h"
+
+namespace ttl {
+	/**
+	 * Logger writing compact binary records instead of text.
+	 * Messages logged using logf() are stored as format string id plus captured arguments,
+	 * each format string is written only once. Use binary_log_reader to turn the log into text offline.
+	 * The arguments are stored in native byte order, so the log needs to be decoded on the same architecture.
+	 */
+	class binarylogger : public logger {
+		enum class record_type : uint8_t {
+			format = 0,
+			text,
+			deferred
+		};
+		friend class binary_log_reader;
+
+		mutable std::mutex m_mtx;
+		buffered_binary_writer m_writer;
+		std::unordered_map<const char*, uint64_t> m_formats;
+
+		void write_header(record_type type, loglevel l, const std::string& module, std::chrono::system_clock::time_point tp) {
+			m_writer.write(static_cast<uint8_t>(type));
+			m_writer.write(static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count()));
+			m_writer.write(static_cast<uint8_t>(l));
+			m_writer.write(module);
+		}
+
+		void write(loglevel l, const std::string& module, const std::string& message) override
+		{
+			write_at(l, module, message, std::chrono::system_clock::now());
+		}
+
+		void write_at(loglevel l, const std::string& module, const std::string& message, std::chrono::system_clock::time_point tp) override
+		{
+			std::unique_lock<std::mutex> lck(m_mtx);
+			write_header(record_type::text, l, module, tp);
+			m_writer.write(message);
+		}
+
+		void write_args(loglevel l, const std::string& module, const char* fmt, const log_args& args) override
+		{
+			const auto tp = std::chrono::system_clock::now();
+			std::unique_lock<std::mutex> lck(m_mtx);
+			auto it = m_formats.find(fmt);
+			if (it == m_formats.end()) {
+				it = m_formats.emplace(fmt, m_formats.size()).first;
+				m_writer.write(static_cast<uint8_t>(record_type::format));
+				m_writer.writeLEB(it->second);
+				m_writer.write(std::string(fmt));
+			}
+			write_header(record_type::deferred, l, module, tp);
+			m_writer.writeLEB(it->second);
+			m_writer.writeLEB(static_cast<uint64_t>(args.count()));
+			m_writer.writeLEB(static_cast<uint64_t>(args.size()));
+			m_writer.write(args.data(), args.size());
+		}
+	public:
+		explicit binarylogger(std::ostream& stream, loglevel level = loglevel::INFO)
+			: logger(level), m_writer(stream, 64 * 1024)
+		{}
+
+		void flush() override {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_writer.flush();
+		}
+	};
+
+	// A single message read from a binary log
+	struct log_entry {
+		loglevel level;
+		std::chrono::system_clock::time_point time;
+		std::string module;
+		std::string message;
+	};
+
+	// Decode logs written by binarylogger
+	class binary_log_reader {
+		std::istream& m_stream;
+		binary_reader m_reader;
+		std::vector<std::string> m_formats;
+		log_args m_args;
+		std::vector<uint8_t> m_buf;
+	public:
+		explicit binary_log_reader(std::istream& stream)
+			: m_stream(stream), m_reader(stream)
+		{}
+
+		// Read the next message, returns false at the end of the log
+		bool read(log_entry& entry) {
+			while (m_stream.peek() != std::istream::traits_type::eof()) {
+				const auto type = static_cast<binarylogger::record_type>(m_reader.read_uint8());
+				if (type == binarylogger::record_type::format) {
+					const auto id = m_reader.read_unsigned_LEB();
+					if (id != m_formats.size())
+						throw std::runtime_error("invalid format id");
+					m_formats.push_back(m_reader.read_string());
+					continue;
+				}
+				const auto ns = m_reader.read_int64();
+				entry.time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(ns)));
+				entry.level = static_cast<loglevel>(m_reader.read_uint8());
+				entry.module = m_reader.read_string();
+				if (type == binarylogger::record_type::text) {
+					entry.message = m_reader.read_string();
+				} else if (type == binarylogger::record_type::deferred) {
+					const auto id = m_reader.read_unsigned_LEB();
+					if (id >= m_formats.size())
+						throw std::runtime_error("invalid format id");
+					const auto count = m_reader.read_unsigned_LEB();
+					m_buf.resize(m_reader.read_unsigned_LEB());
+					m_reader.read_array(m_buf.data(), m_buf.size());
+					m_args.assign(m_buf.data(), m_buf.size(), count);
+					entry.message.clear();
+					m_args.format_to(entry.message, m_formats[id].c_str());
+				} else {
+					throw std::runtime_error("invalid record type");
+				}
+				return true;
+			}
+			return false;
+		}
+	};
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
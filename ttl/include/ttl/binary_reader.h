@@ -1,28 +1,128 @@
 #pragma once
 #include <istream>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include "cxx11_helpers.h"
+#include "endian.h"
 
 namespace ttl
 {
-	class binary_reader {
+	// Source policy reading from a std::istream
+	class stream_source {
 		std::istream& _stream;
+	public:
+		stream_source(std::istream& stream)
+			: _stream(stream)
+		{}
 
-		void read_block(uint8_t* ptr, size_t len) {
+		std::istream& get_stream() { return _stream; }
+
+		void read(uint8_t* ptr, size_t len) {
 			_stream.read(reinterpret_cast<char*>(ptr), static_cast<std::streamsize>(len));
 			if (!_stream) throw std::runtime_error("unexpected end of file");
 		}
+	};
+
+	/**
+	 * Source policy reading directly from a memory range (e.g. ttl::mmap::data()) without copying.
+	 * Every read checks the bounds once, so a scalar still costs one check, only LEB128 values save the per byte checks.
+	 */
+	class memory_source {
+		const uint8_t* _begin;
+		const uint8_t* _pos;
+		const uint8_t* _end;
+	public:
+		memory_source(const uint8_t* data, size_t len)
+			: _begin(data), _pos(data), _end(data + len)
+		{}
+
+		size_t remaining() const { return static_cast<size_t>(_end - _pos); }
+		size_t tell() const { return static_cast<size_t>(_pos - _begin); }
+		const uint8_t* current() const { return _pos; }
+
+		void seek(size_t pos) {
+			if (pos > static_cast<size_t>(_end - _begin)) throw std::out_of_range("invalid position");
+			_pos = _begin + pos;
+		}
+
+		// Return a pointer to the next len bytes and advance past them
+		const uint8_t* consume(size_t len) {
+			if (remaining() < len) throw std::runtime_error("unexpected end of file");
+			auto res = _pos;
+			_pos += len;
+			return res;
+		}
+
+		void read(uint8_t* ptr, size_t len) {
+			memcpy(ptr, consume(len), len);
+		}
+	};
+
+	template<typename Source>
+	class basic_binary_reader {
+		Source _source;
+		endian _endian;
+
+		void read_block(uint8_t* ptr, size_t len) {
+			_source.read(ptr, len);
+		}
 
 		template<typename T>
 		T read_scalar() {
 			T res;
 			read_block(reinterpret_cast<uint8_t*>(&res), sizeof(T));
+			return convert_endian(res, _endian);
+		}
+
+		template<typename S>
+		static uint64_t read_leb(basic_binary_reader& rdr, S&) {
+			uint64_t res = 0;
+			uint8_t t = rdr.read_uint8();
+			int shift = 0;
+			while (t & 0x80) {
+				res |= uint64_t(t & 0x7f) << shift;
+				t = rdr.read_uint8();
+				shift += 7;
+				if (shift >= 64) throw std::runtime_error("invalid LEB128 value");
+			}
+			res |= uint64_t(t) << shift;
 			return res;
 		}
+
+		// Memory fast path, bounds are checked once instead of per byte
+		static uint64_t read_leb(basic_binary_reader&, memory_source& src) {
+			const uint8_t* ptr = src.current();
+			const size_t max = std::min<size_t>(src.remaining(), 10);
+			uint64_t res = 0;
+			for (size_t i = 0; i < max; i++) {
+				res |= uint64_t(ptr[i] & 0x7f) << (7 * i);
+				if (!(ptr[i] & 0x80)) {
+					src.consume(i + 1);
+					return res;
+				}
+			}
+			if (max == 10) throw std::runtime_error("invalid LEB128 value");
+			throw std::runtime_error("unexpected end of file");
+		}
 	public:
-		explicit binary_reader(std::istream& stream)
-			: _stream(stream)
+		explicit basic_binary_reader(const Source& source, endian e = endian::native)
+			: _source(source), _endian(e)
 		{}
 
-		std::istream& get_stream() { return _stream; }
+		// Only available for memory_source
+		basic_binary_reader(const uint8_t* data, size_t len, endian e = endian::native)
+			: _source(data, len), _endian(e)
+		{}
+
+		Source& get_source() { return _source; }
+		// Only available for stream_source
+		std::istream& get_stream() { return _source.get_stream(); }
+
+		// Byte order of numeric values, raw buffers and LEB128 are not affected
+		endian get_endian() const { return _endian; }
+		void set_endian(endian e) { _endian = e; }
 
 		uint8_t read_uint8() { return read_scalar<uint8_t>(); }
 		int8_t read_int8() { return read_scalar<int8_t>(); }
@@ -37,20 +137,25 @@ namespace ttl
 		bool read_bool() { return read_uint8() != 0; }
 
 		uint64_t read_unsigned_LEB() {
-			uint64_t res = 0;
-			uint8_t t = read_uint8();
-			int shift = 0;
-			while (t & 0x80) {
-				res |= uint64_t(t & 0x7f) << shift;
-				t = read_uint8();
-				shift += 7;
-			}
-			res |= uint64_t(t) << shift;
-			return res;
+			return read_leb(*this, _source);
 		}
 		int64_t read_LEB() {
 			return static_cast<int64_t>(read_unsigned_LEB());
 		}
+		int64_t read_zigzag() {
+			auto value = read_unsigned_LEB();
+			return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+		}
+
+		// Read count numeric values in one block and convert them to native byte order
+		template<typename T>
+		void read_array(T* values, size_t count) {
+			static_assert(std::is_arithmetic<T>::value, "read_array requires an arithmetic type");
+			if (count > std::numeric_limits<size_t>::max() / sizeof(T))
+				throw std::length_error("array too large");
+			read_block(reinterpret_cast<uint8_t*>(values), count * sizeof(T));
+			convert_endian(values, count, _endian);
+		}
 
 		std::string read_string() {
 			auto size = read_unsigned_LEB();
@@ -59,7 +164,17 @@ namespace ttl
 			read_block(reinterpret_cast<uint8_t*>(const_cast<char*>(res.data())), size);
 			return res;
 		}
+
+		// Only available for memory_source, the result points into the source memory
+		string_view read_string_view() {
+			auto size = static_cast<size_t>(read_unsigned_LEB());
+			return string_view(reinterpret_cast<const char*>(_source.consume(size)), size);
+		}
 	};
+
+	// Not a class anymore, so code forward declaring binary_reader needs to include this header instead
+	typedef basic_binary_reader<stream_source> binary_reader;
+	typedef basic_binary_reader<memory_source> memory_binary_reader;
 }
 
 #ifdef TTL_OLD_NAMESPACE
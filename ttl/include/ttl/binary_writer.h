@@ -1,19 +1,189 @@
 #pragma once
 #include <ostream>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include "endian.h"
 
 namespace ttl
 {
-	class binary_writer {
+	// Sink policy writing every call directly to a std::ostream
+	class stream_sink {
 		std::ostream& _stream;
 	public:
-		explicit binary_writer(std::ostream& stream)
+		stream_sink(std::ostream& stream)
 			: _stream(stream)
 		{}
 
 		std::ostream& get_stream() { return _stream; }
 
+		void write(const uint8_t* ptr, size_t len) {
+			_stream.write(reinterpret_cast<const char*>(ptr), static_cast<std::streamsize>(len));
+		}
+
+		void flush() {
+			_stream.flush();
+		}
+	};
+
+	/**
+	 * Sink policy collecting writes in a contiguous buffer and passing them to the stream in large blocks.
+	 * The buffer is either allocated internally or provided by the user (arena), pending data is written on flush() or destruction.
+	 */
+	class buffered_sink {
+		std::ostream* _stream;
+		std::vector<uint8_t> _own;
+		uint8_t* _buf;
+		size_t _capacity;
+		size_t _pos;
+	public:
+		buffered_sink(std::ostream& stream, size_t bufsize = 64 * 1024)
+			: _stream(&stream), _own(bufsize), _buf(_own.data()), _capacity(bufsize), _pos(0)
+		{
+			if (bufsize == 0)
+				throw std::invalid_argument("buffer size must be larger than 0");
+		}
+
+		buffered_sink(std::ostream& stream, uint8_t* arena, size_t len)
+			: _stream(&stream), _buf(arena), _capacity(len), _pos(0)
+		{
+			if (arena == nullptr || len == 0)
+				throw std::invalid_argument("invalid arena");
+		}
+
+		buffered_sink(const buffered_sink&) = delete;
+		buffered_sink& operator=(const buffered_sink&) = delete;
+
+		buffered_sink(buffered_sink&& other)
+			: _stream(other._stream), _own(std::move(other._own)), _buf(other._buf), _capacity(other._capacity), _pos(other._pos)
+		{
+			other._pos = 0;
+		}
+
+		~buffered_sink() {
+			flush();
+		}
+
+		std::ostream& get_stream() { return *_stream; }
+
+		size_t buffered() const { return _pos; }
+
+		void write(const uint8_t* ptr, size_t len) {
+			if (len <= _capacity - _pos) {
+				memcpy(_buf + _pos, ptr, len);
+				_pos += len;
+				return;
+			}
+			flush_buffer();
+			if (len >= _capacity) {
+				_stream->write(reinterpret_cast<const char*>(ptr), static_cast<std::streamsize>(len));
+			} else {
+				memcpy(_buf, ptr, len);
+				_pos = len;
+			}
+		}
+
+		void flush_buffer() {
+			if (_pos == 0)
+				return;
+			_stream->write(reinterpret_cast<const char*>(_buf), static_cast<std::streamsize>(_pos));
+			_pos = 0;
+		}
+
+		void flush() {
+			flush_buffer();
+			_stream->flush();
+		}
+	};
+
+	template<typename Sink>
+	class basic_binary_writer {
+		Sink _sink;
+		endian _endian;
+
+		template<typename T>
+		void write_scalar(T value) {
+			value = convert_endian(value, _endian);
+			write(reinterpret_cast<const uint8_t*>(&value), sizeof(T));
+		}
+
+		static size_t encode_LEB(uint64_t value, uint8_t* out) {
+			size_t len = 0;
+			while (value >= 128) {
+				out[len++] = static_cast<uint8_t>(value | 0x80);
+				value >>= 7;
+			}
+			out[len++] = static_cast<uint8_t>(value);
+			return len;
+		}
+
+		static uint64_t zigzag(int64_t value) {
+			return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+		}
+
+		/**
+		 * Encode count values as LEB128, blocks of 8 values that all fit into a single byte are
+		 * stored by a branch free loop the compiler can vectorize.
+		 */
+		template<typename T, typename Transform>
+		void write_LEB_block(const T* values, size_t count, Transform fn) {
+			std::array<uint8_t, 1024> chunk;
+			size_t pos = 0;
+			size_t i = 0;
+			for (; i + 8 <= count; i += 8) {
+				uint64_t v[8];
+				uint64_t large = 0;
+				for (size_t j = 0; j < 8; j++) {
+					v[j] = fn(values[i + j]);
+					large |= v[j];
+				}
+				if (large < 128) {
+					for (size_t j = 0; j < 8; j++)
+						chunk[pos + j] = static_cast<uint8_t>(v[j]);
+					pos += 8;
+				} else {
+					for (size_t j = 0; j < 8; j++)
+						pos += encode_LEB(v[j], chunk.data() + pos);
+				}
+				if (pos > chunk.size() - 8 * 10) {
+					write(chunk.data(), pos);
+					pos = 0;
+				}
+			}
+			for (; i < count; i++)
+				pos += encode_LEB(fn(values[i]), chunk.data() + pos);
+			write(chunk.data(), pos);
+		}
+	public:
+		explicit basic_binary_writer(Sink sink, endian e = endian::native)
+			: _sink(std::move(sink)), _endian(e)
+		{}
+
+		// Only available for buffered_sink
+		basic_binary_writer(std::ostream& stream, size_t bufsize, endian e = endian::native)
+			: _sink(stream, bufsize), _endian(e)
+		{}
+
+		// Only available for buffered_sink
+		basic_binary_writer(std::ostream& stream, uint8_t* arena, size_t len, endian e = endian::native)
+			: _sink(stream, arena, len), _endian(e)
+		{}
+
+		Sink& get_sink() { return _sink; }
+		std::ostream& get_stream() { return _sink.get_stream(); }
+
+		// Byte order used for numeric values, raw buffers and LEB128 are not affected
+		endian get_endian() const { return _endian; }
+		void set_endian(endian e) { _endian = e; }
+
+		// Pass all buffered data to the stream and flush it
+		void flush() { _sink.flush(); }
+
 		void write(const uint8_t* value, size_t len) {
-			_stream.write(reinterpret_cast<const char*>(value), static_cast<std::streamsize>(len));
+			_sink.write(value, len);
 		}
 
 		void write(const uint8_t* value, size_t start, size_t len) {
@@ -21,7 +191,7 @@ namespace ttl
 		}
 
 		void write(const char* value, size_t len) {
-			_stream.write(value, static_cast<std::streamsize>(len));
+			write(reinterpret_cast<const uint8_t*>(value), len);
 		}
 
 		void write(const char* value, size_t start, size_t len) {
@@ -40,52 +210,58 @@ namespace ttl
 			this->write(value ? uint8_t(1) : uint8_t(0));
 		}
 
-		void write(double value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(double));
-		}
-
-		void write(float value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(float));
-		}
-
-		void write(int16_t value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(int16_t));
-		}
-
-		void write(int32_t value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(int32_t));
-		}
+		void write(double value) { write_scalar(value); }
+		void write(float value) { write_scalar(value); }
+		void write(int16_t value) { write_scalar(value); }
+		void write(int32_t value) { write_scalar(value); }
+		void write(int64_t value) { write_scalar(value); }
+		void write(uint16_t value) { write_scalar(value); }
+		void write(uint32_t value) { write_scalar(value); }
+		void write(uint64_t value) { write_scalar(value); }
 
-		void write(int64_t value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(int64_t));
+		void writeLEB(uint64_t value) {
+			uint8_t buf[10];
+			write(buf, encode_LEB(value, buf));
 		}
 
-		void write(uint16_t value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(uint16_t));
+		void writeLEB(int64_t value) {
+			writeLEB(static_cast<uint64_t>(value));
 		}
 
-		void write(uint32_t value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(uint32_t));
+		// Signed LEB128 variant mapping small negative numbers to short encodings
+		void writeZigZag(int64_t value) {
+			writeLEB(zigzag(value));
 		}
 
-		void write(uint64_t value) {
-			write(reinterpret_cast<uint8_t*>(&value), sizeof(uint64_t));
+		template<typename T>
+		void writeLEB(const T* values, size_t count) {
+			static_assert(std::is_integral<T>::value, "LEB128 requires integral values");
+			write_LEB_block(values, count, [](T v) { return static_cast<uint64_t>(v); });
 		}
 
-		void writeLEB(uint64_t value) {
-			do {
-				if (value < 128) {
-					write(static_cast<uint8_t>(value));
-				}
-				else {
-					write(static_cast<uint8_t>(value | 0x80));
-				}
-				value = value >> 7;
-			} while (value != 0);
+		template<typename T>
+		void writeZigZag(const T* values, size_t count) {
+			static_assert(std::is_integral<T>::value && std::is_signed<T>::value, "zigzag requires signed integral values");
+			write_LEB_block(values, count, [](T v) { return zigzag(v); });
 		}
 
-		void writeLEB(int64_t value) {
-			writeLEB(static_cast<uint64_t>(value));
+		// Write count numeric values in the configured byte order, native order is written as a single block
+		template<typename T>
+		void write_array(const T* values, size_t count) {
+			static_assert(std::is_arithmetic<T>::value, "write_array requires an arithmetic type");
+			if (_endian == endian::native) {
+				write(reinterpret_cast<const uint8_t*>(values), count * sizeof(T));
+				return;
+			}
+			std::array<T, 4096 / sizeof(T)> chunk;
+			while (count != 0) {
+				const size_t n = std::min(count, chunk.size());
+				memcpy(chunk.data(), values, n * sizeof(T));
+				byteswap_array(chunk.data(), n);
+				write(reinterpret_cast<const uint8_t*>(chunk.data()), n * sizeof(T));
+				values += n;
+				count -= n;
+			}
 		}
 
 		void write(const std::string& value) {
@@ -93,6 +269,9 @@ namespace ttl
 			write(value.data(), value.size());
 		}
 	};
+
+	typedef basic_binary_writer<stream_sink> binary_writer;
+	typedef basic_binary_writer<buffered_sink> buffered_binary_writer;
 }
 
 #ifdef TTL_OLD_NAMESPACE
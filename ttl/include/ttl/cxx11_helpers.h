@@ -1,6 +1,10 @@
 #pragma once
 #include <memory>
 #include <type_traits>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
 
 namespace ttl
 {
@@ -18,6 +22,24 @@ namespace ttl
     template<bool Cond, typename IfTrue, typename IfFalse>
     using conditional_t = typename std::conditional<Cond, IfTrue, IfFalse>::type;
 
+#ifdef __cpp_lib_integer_sequence
+    using ::std::index_sequence;
+    using ::std::make_index_sequence;
+#else
+    template<size_t... I>
+    struct index_sequence {};
+
+    template<size_t N, size_t... I>
+    struct make_index_sequence_impl : make_index_sequence_impl<N - 1, N - 1, I...> {};
+    template<size_t... I>
+    struct make_index_sequence_impl<0, I...> {
+        typedef index_sequence<I...> type;
+    };
+
+    template<size_t N>
+    using make_index_sequence = typename make_index_sequence_impl<N>::type;
+#endif
+
     template<typename C>
     inline constexpr auto cbegin(const C& cont) noexcept(noexcept(std::begin(cont)))
         -> decltype(std::begin(cont))
@@ -27,4 +49,42 @@ namespace ttl
     inline constexpr auto cend(const C& cont) noexcept(noexcept(std::end(cont)))
         -> decltype(std::end(cont))
         { return std::end(cont); }
+
+#ifdef __cpp_lib_string_view
+    using ::std::string_view;
+#else
+    // Minimal non owning reference to a char range, use std::string_view if available
+    class string_view {
+        const char* m_data;
+        size_t m_size;
+    public:
+        typedef const char* const_iterator;
+        typedef const_iterator iterator;
+
+        constexpr string_view() noexcept : m_data(nullptr), m_size(0) {}
+        constexpr string_view(const char* data, size_t size) noexcept : m_data(data), m_size(size) {}
+        string_view(const char* str) : m_data(str), m_size(std::strlen(str)) {}
+        string_view(const std::string& str) noexcept : m_data(str.data()), m_size(str.size()) {}
+
+        constexpr const char* data() const noexcept { return m_data; }
+        constexpr size_t size() const noexcept { return m_size; }
+        constexpr size_t length() const noexcept { return m_size; }
+        constexpr bool empty() const noexcept { return m_size == 0; }
+        constexpr const_iterator begin() const noexcept { return m_data; }
+        constexpr const_iterator end() const noexcept { return m_data + m_size; }
+        constexpr const char& operator[](size_t idx) const { return m_data[idx]; }
+
+        string_view substr(size_t pos, size_t len = std::string::npos) const {
+            if (pos > m_size) throw std::out_of_range("invalid pos");
+            return string_view(m_data + pos, std::min(len, m_size - pos));
+        }
+
+        explicit operator std::string() const { return std::string(m_data, m_size); }
+
+        friend bool operator==(string_view lhs, string_view rhs) noexcept {
+            return lhs.m_size == rhs.m_size && (lhs.m_size == 0 || std::memcmp(lhs.m_data, rhs.m_data, lhs.m_size) == 0);
+        }
+        friend bool operator!=(string_view lhs, string_view rhs) noexcept { return !(lhs == rhs); }
+    };
+#endif
 }
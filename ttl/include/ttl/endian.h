@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+namespace ttl
+{
+	enum class endian {
+#ifdef _WIN32
+		little = 0,
+		big = 1,
+		native = little
+#else
+		little = __ORDER_LITTLE_ENDIAN__,
+		big = __ORDER_BIG_ENDIAN__,
+		native = __BYTE_ORDER__
+#endif
+	};
+
+	inline uint8_t byteswap(uint8_t value) noexcept { return value; }
+
+	inline uint16_t byteswap(uint16_t value) noexcept {
+#ifdef _MSC_VER
+		return _byteswap_ushort(value);
+#else
+		return __builtin_bswap16(value);
+#endif
+	}
+
+	inline uint32_t byteswap(uint32_t value) noexcept {
+#ifdef _MSC_VER
+		return _byteswap_ulong(value);
+#else
+		return __builtin_bswap32(value);
+#endif
+	}
+
+	inline uint64_t byteswap(uint64_t value) noexcept {
+#ifdef _MSC_VER
+		return _byteswap_uint64(value);
+#else
+		return __builtin_bswap64(value);
+#endif
+	}
+
+	namespace detail {
+		template<size_t Size> struct uint_of_size;
+		template<> struct uint_of_size<1> { typedef uint8_t type; };
+		template<> struct uint_of_size<2> { typedef uint16_t type; };
+		template<> struct uint_of_size<4> { typedef uint32_t type; };
+		template<> struct uint_of_size<8> { typedef uint64_t type; };
+	}
+
+	// Reverse the byte order of any arithmetic value (including float and double)
+	template<typename T>
+	inline T byteswap_value(T value) noexcept {
+		static_assert(std::is_arithmetic<T>::value, "byteswap_value requires an arithmetic type");
+		typename detail::uint_of_size<sizeof(T)>::type bits;
+		memcpy(&bits, &value, sizeof(T));
+		bits = byteswap(bits);
+		memcpy(&value, &bits, sizeof(T));
+		return value;
+	}
+
+	/**
+	 * Reverse the byte order of count values in place.
+	 * Kept as a simple loop on the matching unsigned type so the compiler can turn it into vector shuffles.
+	 */
+	template<typename T>
+	inline void byteswap_array(T* values, size_t count) noexcept {
+		static_assert(std::is_arithmetic<T>::value, "byteswap_array requires an arithmetic type");
+		typedef typename detail::uint_of_size<sizeof(T)>::type uint_type;
+		if (sizeof(T) == 1)
+			return;
+		auto bytes = reinterpret_cast<unsigned char*>(values);
+		for (size_t i = 0; i < count; i++) {
+			uint_type bits;
+			memcpy(&bits, bytes + i * sizeof(T), sizeof(T));
+			bits = byteswap(bits);
+			memcpy(bytes + i * sizeof(T), &bits, sizeof(T));
+		}
+	}
+
+	// Convert between native byte order and e (the operation is its own inverse)
+	template<typename T>
+	inline T convert_endian(T value, endian e) noexcept {
+		return e == endian::native ? value : byteswap_value(value);
+	}
+
+	template<typename T>
+	inline void convert_endian(T* values, size_t count, endian e) noexcept {
+		if (e != endian::native)
+			byteswap_array(values, count);
+	}
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
@@ -0,0 +1,116 @@
+#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include "noncopyable.h"
+#include "timer.h"
+
+namespace ttl {
+	// Runs the passed function, possibly on another thread. Same signature as timer and async_signal executors.
+	typedef std::function<void(std::function<void()>)> executor_t;
+
+	// Runs functions immediately on the calling thread
+	inline executor_t inline_executor() {
+		return [](std::function<void()> fn) { fn(); };
+	}
+
+	/**
+	 * Fixed number of worker threads running posted functions in FIFO order.
+	 * Exceptions thrown by a function are ignored, all pending functions run before the destructor returns.
+	 */
+	class thread_pool : public noncopyable {
+		std::mutex m_mtx;
+		std::condition_variable m_cv;
+		std::condition_variable m_idle_cv;
+		std::deque<std::function<void()>> m_queue;
+		size_t m_active;
+		bool m_exit;
+		std::vector<std::thread> m_threads;
+
+		void thread_fn() {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			while (true) {
+				m_cv.wait(lck, [this]() { return m_exit || !m_queue.empty(); });
+				if (m_queue.empty())
+					break;
+				auto fn = std::move(m_queue.front());
+				m_queue.pop_front();
+				m_active++;
+				lck.unlock();
+				try {
+					fn();
+				} catch (...) {}
+				// Release captures before reporting idle
+				fn = nullptr;
+				lck.lock();
+				m_active--;
+				if (m_active == 0 && m_queue.empty())
+					m_idle_cv.notify_all();
+			}
+		}
+	public:
+		explicit thread_pool(size_t threads = std::thread::hardware_concurrency())
+			: m_active(0), m_exit(false)
+		{
+			if (threads == 0)
+				threads = 1;
+			for (size_t i = 0; i < threads; i++)
+				m_threads.emplace_back(&thread_pool::thread_fn, this);
+		}
+
+		~thread_pool() {
+			{
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_exit = true;
+				m_cv.notify_all();
+			}
+			for (auto& t : m_threads)
+				t.join();
+		}
+
+		void post(std::function<void()> fn) {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_queue.push_back(std::move(fn));
+			m_cv.notify_one();
+		}
+
+		void operator()(std::function<void()> fn) {
+			post(std::move(fn));
+		}
+
+		// Wait until the queue is empty and no function is running, must not be called from a worker
+		void wait_idle() {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_idle_cv.wait(lck, [this]() { return m_active == 0 && m_queue.empty(); });
+		}
+
+		size_t get_thread_count() const { return m_threads.size(); }
+
+		// Executor posting to this pool, the pool needs to outlive it
+		executor_t executor() {
+			return [this](std::function<void()> fn) { post(std::move(fn)); };
+		}
+	};
+
+	// Single dedicated thread, functions run in the order they were posted
+	class thread_executor : public thread_pool {
+	public:
+		thread_executor()
+			: thread_pool(1)
+		{}
+	};
+
+	// Executor running functions on the timer after delay (on its thread or its configured executor), the timer needs to outlive it
+	template<typename Rep = int64_t, typename Period = std::nano>
+	executor_t timer_executor(timer& t, std::chrono::duration<Rep, Period> delay = std::chrono::duration<Rep, Period>::zero()) {
+		return [&t, delay](std::function<void()> fn) { t.schedule(std::move(fn), delay); };
+	}
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
@@ -0,0 +1,313 @@
+#pragma once
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <streambuf>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+#include "logger.h"
+#include "io/deflate_stream.h"
+
+namespace ttl {
+	struct rotation_options {
+		// Rotate before the file grows beyond this many bytes (0 = no limit)
+		uint64_t max_size = 0;
+		// Rotate once the file was open for this long (0 = never)
+		std::chrono::seconds max_age{ 0 };
+		// Number of rotated files kept as path.1 (newest) ... path.N
+		size_t max_files = 5;
+		// Compress rotated files using gzip (path.1.gz ...)
+		bool compress = false;
+		// Size of the user space write buffer
+		size_t buffer_size = 64 * 1024;
+	};
+
+	/**
+	 * Streambuf appending to a file through a large buffer and rotating it based on size or age.
+	 * Rotation is only checked in xsputn and sync, so a line written in a single call is never split between files.
+	 * The writing thread only renames the full file and opens a new one, shifting old files
+	 * and compressing is done by a background thread.
+	 */
+	class rotating_filebuf : public std::streambuf {
+		const std::string m_path;
+		const rotation_options m_options;
+		std::vector<char> m_buffer;
+		FILE* m_file;
+		// Bytes already written to the file (excluding the buffer)
+		uint64_t m_file_size;
+		std::chrono::steady_clock::time_point m_opened;
+		std::atomic<bool> m_rotate_requested;
+		uint64_t m_sequence;
+
+		std::mutex m_mtx;
+		std::condition_variable m_cv;
+		std::deque<std::string> m_pending;
+		bool m_exit;
+		std::thread m_thread;
+
+		bool open_file() {
+			m_file = fopen(m_path.c_str(), "ab");
+			if (m_file == nullptr)
+				return false;
+			// Data is buffered in m_buffer already, so every flush becomes a single append
+			setvbuf(m_file, nullptr, _IONBF, 0);
+			fseek(m_file, 0, SEEK_END);
+			const auto pos = ftell(m_file);
+			m_file_size = pos > 0 ? static_cast<uint64_t>(pos) : 0;
+			m_opened = std::chrono::steady_clock::now();
+			return true;
+		}
+
+		bool write_buffer() {
+			const auto n = static_cast<size_t>(pptr() - pbase());
+			setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+			if (n == 0)
+				return true;
+			return write_file(m_buffer.data(), n);
+		}
+
+		bool write_file(const char* data, size_t len) {
+			// Reopen if a previous rotation failed to create the new file
+			if (m_file == nullptr && !open_file())
+				return false;
+			const auto res = fwrite(data, 1, len, m_file);
+			m_file_size += res;
+			return res == len;
+		}
+
+		bool need_rotation(size_t incoming) {
+			const uint64_t current = m_file_size + static_cast<uint64_t>(pptr() - pbase());
+			if (m_rotate_requested.exchange(false))
+				return current != 0;
+			if (current == 0)
+				return false;
+			if (m_options.max_size != 0 && current + incoming > m_options.max_size)
+				return true;
+			return m_options.max_age.count() != 0 && std::chrono::steady_clock::now() - m_opened >= m_options.max_age;
+		}
+
+		void rotate() {
+			write_buffer();
+			if (m_file != nullptr) {
+				fclose(m_file);
+				m_file = nullptr;
+			}
+			auto pending = m_path + ".pending." + std::to_string(++m_sequence);
+			if (std::rename(m_path.c_str(), pending.c_str()) == 0) {
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_pending.push_back(std::move(pending));
+				m_cv.notify_all();
+			}
+			open_file();
+		}
+
+		/**
+		 * Rotated files a previous process did not archive before it exited, oldest first.
+		 * They are queued for archiving and numbering continues after them, so rotate() never overwrites one.
+		 */
+		std::vector<std::pair<uint64_t, std::string>> find_pending() const {
+			const auto sep = m_path.find_last_of("/\\");
+			const auto dir = sep == std::string::npos ? std::string() : m_path.substr(0, sep + 1);
+			const auto prefix = m_path.substr(dir.size()) + ".pending.";
+			std::vector<std::pair<uint64_t, std::string>> res;
+			auto check = [&](const char* name) {
+				if (strncmp(name, prefix.c_str(), prefix.size()) != 0)
+					return;
+				const char* num = name + prefix.size();
+				if (*num == '\0' || strspn(num, "0123456789") != strlen(num))
+					return;
+				res.emplace_back(std::stoull(num), dir + name);
+			};
+#ifdef _WIN32
+			WIN32_FIND_DATAA data;
+			const auto handle = FindFirstFileA((dir + prefix + "*").c_str(), &data);
+			if (handle != INVALID_HANDLE_VALUE) {
+				do {
+					check(data.cFileName);
+				} while (FindNextFileA(handle, &data));
+				FindClose(handle);
+			}
+#else
+			const auto d = opendir(dir.empty() ? "." : dir.c_str());
+			if (d != nullptr) {
+				while (const auto e = readdir(d))
+					check(e->d_name);
+				closedir(d);
+			}
+#endif
+			std::sort(res.begin(), res.end());
+			return res;
+		}
+
+		std::string archive_name(size_t idx) const {
+			return m_path + "." + std::to_string(idx) + (m_options.compress ? ".gz" : "");
+		}
+
+		void archive(const std::string& pending) {
+			if (m_options.max_files == 0) {
+				std::remove(pending.c_str());
+				return;
+			}
+			std::remove(archive_name(m_options.max_files).c_str());
+			for (size_t i = m_options.max_files; i > 1; i--)
+				std::rename(archive_name(i - 1).c_str(), archive_name(i).c_str());
+			if (m_options.compress) {
+				{
+					std::ifstream in(pending, std::ios::binary);
+					std::ofstream out(archive_name(1), std::ios::binary | std::ios::trunc);
+					io::deflate_ostream zout(out, 6, 15, io::deflater::wrapper::gzip);
+					if (in.peek() != std::ifstream::traits_type::eof())
+						zout << in.rdbuf();
+				}
+				std::remove(pending.c_str());
+			} else {
+				std::rename(pending.c_str(), archive_name(1).c_str());
+			}
+		}
+
+		void thread_fn() {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			while (true) {
+				m_cv.wait(lck, [this]() { return m_exit || !m_pending.empty(); });
+				if (m_pending.empty())
+					break;
+				const auto pending = m_pending.front();
+				lck.unlock();
+				archive(pending);
+				lck.lock();
+				// Only remove it after archiving, so wait_rotation() also waits for the current file
+				m_pending.pop_front();
+				m_cv.notify_all();
+			}
+		}
+	protected:
+		std::streamsize xsputn(const char* s, std::streamsize n) override {
+			const auto len = static_cast<size_t>(n);
+			if (need_rotation(len))
+				rotate();
+			if (n > epptr() - pptr()) {
+				if (!write_buffer())
+					return 0;
+				if (len >= m_buffer.size())
+					return write_file(s, len) ? n : 0;
+			}
+			memcpy(pptr(), s, len);
+			pbump(static_cast<int>(n));
+			return n;
+		}
+
+		int_type overflow(int_type ch) override {
+			if (!write_buffer())
+				return traits_type::eof();
+			if (ch != traits_type::eof()) {
+				*pptr() = traits_type::to_char_type(ch);
+				pbump(1);
+			}
+			return traits_type::not_eof(ch);
+		}
+
+		int sync() override {
+			if (need_rotation(0))
+				rotate();
+			return write_buffer() ? 0 : -1;
+		}
+	public:
+		explicit rotating_filebuf(std::string path, rotation_options options = rotation_options())
+			: m_path(std::move(path)), m_options(options), m_buffer(options.buffer_size < 1 ? 1 : options.buffer_size),
+			m_file(nullptr), m_file_size(0), m_rotate_requested(false), m_sequence(0), m_exit(false)
+		{
+			if (!open_file())
+				throw std::runtime_error("failed to open " + m_path);
+			for (auto& e : find_pending()) {
+				m_sequence = e.first;
+				m_pending.push_back(std::move(e.second));
+			}
+			setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+			m_thread = std::thread(&rotating_filebuf::thread_fn, this);
+		}
+
+		~rotating_filebuf() override {
+			write_buffer();
+			if (m_file != nullptr)
+				fclose(m_file);
+			{
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_exit = true;
+				m_cv.notify_all();
+			}
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+
+		// Rotate the file on the next write or sync
+		void request_rotation() {
+			m_rotate_requested = true;
+		}
+
+		// Wait until all rotated files are moved and compressed
+		void wait_rotation() {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_cv.wait(lck, [this]() { return m_pending.empty(); });
+		}
+
+		const std::string& get_path() const { return m_path; }
+		const rotation_options& get_options() const { return m_options; }
+	};
+
+	namespace detail {
+		// Constructed before the streamlogger base, so the stream is valid when it is passed on
+		struct file_logger_stream {
+			rotating_filebuf m_buf;
+			std::ostream m_stream;
+
+			file_logger_stream(std::string path, rotation_options options)
+				: m_buf(std::move(path), options), m_stream(&m_buf)
+			{}
+		};
+	}
+
+	/**
+	 * streamlogger writing to a size or time rotated file.
+	 * Autoflush is disabled by default, messages are written once the buffer is full or flush() is called.
+	 * Wrap it in an async_logger to get a flush per batch of messages without blocking the logging threads.
+	 */
+	class file_logger : private detail::file_logger_stream, public streamlogger {
+	public:
+		explicit file_logger(std::string path, loglevel level = loglevel::INFO, rotation_options options = rotation_options())
+			: file_logger_stream(std::move(path), options), streamlogger(m_stream, level)
+		{
+			set_autoflush(false);
+		}
+
+		// Start a new file, the current one is archived in the background
+		void rotate() {
+			m_buf.request_rotation();
+			flush();
+		}
+
+		// Wait until all rotated files are moved and compressed
+		void wait_rotation() {
+			m_buf.wait_rotation();
+		}
+
+		const std::string& get_path() const { return m_buf.get_path(); }
+	};
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
@@ -0,0 +1,163 @@
+#pragma once
+#include <ostream>
+#include <streambuf>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "../mmap.h"
+
+namespace ttl {
+	namespace io {
+		/**
+		 * Output streambuffer writing directly into a writable memory mapped file.
+		 * The put area is the mapping itself, so writes are plain memory copies into the page cache.
+		 * The file grows geometrically once the mapping is full and is truncated to the written size on finish.
+		 */
+		class mmap_ostreambuf : public std::streambuf {
+			ttl::mmap map;
+			// Number of bytes written so far (the put pointer may be behind after seeking)
+			uint64_t written;
+
+			uint64_t position() const {
+				return static_cast<uint64_t>(pptr() - pbase());
+			}
+
+			void update_written() {
+				if (pbase() != nullptr)
+					written = std::max(written, position());
+			}
+
+			void set_position(uint64_t pos) {
+				auto ptr = reinterpret_cast<char*>(map.data());
+				setp(ptr, ptr + map.size());
+				// pbump only takes an int
+				while (pos > static_cast<uint64_t>(INT_MAX)) {
+					pbump(INT_MAX);
+					pos -= INT_MAX;
+				}
+				pbump(static_cast<int>(pos));
+			}
+
+			bool grow(uint64_t needed) {
+				update_written();
+				const uint64_t pos = position();
+				const uint64_t size = std::max(std::max(uint64_t(map.size()) * 2, pos + needed), uint64_t(map.page_size()));
+				if (!map.resize(size))
+					return false;
+				set_position(pos);
+				return true;
+			}
+		public:
+			explicit mmap_ostreambuf(const std::string& fname, size_t initial_size = 1024 * 1024)
+				: written(0)
+			{
+				if (!map.open(fname, ttl::mmap::access::read_write))
+					throw std::runtime_error("failed to open file");
+				// Drop old content, new pages are zero filled
+				if (!map.resize(0) || !map.resize(std::max(initial_size, map.page_size())))
+					throw std::runtime_error("failed to resize file");
+				set_position(0);
+			}
+
+			~mmap_ostreambuf() override {
+				finish();
+			}
+
+			// Truncate the file to the written size and close it
+			void finish() {
+				if (!map.is_open())
+					return;
+				update_written();
+				setp(nullptr, nullptr);
+				map.resize(written);
+				map.close();
+			}
+
+			uint64_t size() const {
+				return pbase() != nullptr ? std::max(written, position()) : written;
+			}
+
+			// Write changes back to disk and wait until the write finished
+			bool flush_to_disk() {
+				update_written();
+				return written == 0 || map.flush(0, static_cast<size_t>(written), false);
+			}
+		private:
+			int_type overflow(int_type ch) override {
+				if (traits_type::eq_int_type(ch, traits_type::eof()))
+					return traits_type::not_eof(ch);
+				if (!map.is_open() || !grow(1))
+					return traits_type::eof();
+				*pptr() = traits_type::to_char_type(ch);
+				pbump(1);
+				return ch;
+			}
+
+			std::streamsize xsputn(const char* s, std::streamsize n) override {
+				if (n <= 0)
+					return 0;
+				const auto len = static_cast<uint64_t>(n);
+				if (static_cast<uint64_t>(epptr() - pptr()) < len) {
+					if (!map.is_open() || !grow(len))
+						return 0;
+				}
+				memcpy(pptr(), s, static_cast<size_t>(len));
+				set_position(position() + len);
+				return n;
+			}
+
+			pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+				if (!(which & std::ios_base::out) || pbase() == nullptr)
+					return pos_type(off_type(-1));
+				update_written();
+				off_type base = 0;
+				if (dir == std::ios_base::cur)
+					base = static_cast<off_type>(position());
+				else if (dir == std::ios_base::end)
+					base = static_cast<off_type>(written);
+				const off_type pos = base + off;
+				if (pos < 0 || static_cast<uint64_t>(pos) > written)
+					return pos_type(off_type(-1));
+				set_position(static_cast<uint64_t>(pos));
+				return pos_type(pos);
+			}
+
+			pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+				return seekoff(off_type(pos), std::ios_base::beg, which);
+			}
+
+			// Data is already in the page cache, only schedule the writeback
+			int sync() override {
+				update_written();
+				if (written == 0 || pbase() == nullptr)
+					return 0;
+				return map.flush(0, static_cast<size_t>(written), true) ? 0 : -1;
+			}
+		};
+
+		// Write into a file using a writable memory mapping
+		class mmap_ostream : private mmap_ostreambuf, public std::ostream {
+		public:
+			explicit mmap_ostream(const std::string& fname, size_t initial_size = 1024 * 1024)
+				: mmap_ostreambuf(fname, initial_size), std::ostream(this)
+			{
+			}
+
+			void finish() {
+				mmap_ostreambuf::finish();
+			}
+
+			uint64_t size() const {
+				return mmap_ostreambuf::size();
+			}
+
+			bool flush_to_disk() {
+				return mmap_ostreambuf::flush_to_disk();
+			}
+		};
+	}
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
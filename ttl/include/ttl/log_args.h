@@ -0,0 +1,169 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ttl {
+	/**
+	 * Compact type tagged binary representation of log message arguments.
+	 * Arithmetic values and strings are copied as is, other types are formatted using operator<< at capture time.
+	 * Formatting the final message is deferred until format() is called, which replaces every "{}" in the
+	 * format string by the next argument and appends surplus arguments separated by spaces.
+	 * Values are stored in native byte order.
+	 */
+	class log_args {
+	public:
+		enum class tag : uint8_t {
+			boolean = 0,
+			character,
+			int64,
+			uint64,
+			floating,
+			string
+		};
+	private:
+		std::vector<uint8_t> m_data;
+		size_t m_count = 0;
+
+		template<typename T>
+		void append(tag t, const T& value) {
+			const auto pos = m_data.size();
+			m_data.resize(pos + 1 + sizeof(T));
+			m_data[pos] = static_cast<uint8_t>(t);
+			memcpy(m_data.data() + pos + 1, &value, sizeof(T));
+			m_count++;
+		}
+
+		void append_string(const char* str, size_t len) {
+			const auto pos = m_data.size();
+			const auto len32 = static_cast<uint32_t>(len);
+			m_data.resize(pos + 1 + sizeof(len32) + len);
+			m_data[pos] = static_cast<uint8_t>(tag::string);
+			memcpy(m_data.data() + pos + 1, &len32, sizeof(len32));
+			memcpy(m_data.data() + pos + 1 + sizeof(len32), str, len);
+			m_count++;
+		}
+
+		void encode(bool value) { append(tag::boolean, static_cast<uint8_t>(value ? 1 : 0)); }
+		void encode(char value) { append(tag::character, value); }
+		void encode(const char* value) { append_string(value, strlen(value)); }
+		void encode(const std::string& value) { append_string(value.data(), value.size()); }
+
+		template<typename T>
+		typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type encode(const T& value) {
+			append(tag::int64, static_cast<int64_t>(value));
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type encode(const T& value) {
+			append(tag::uint64, static_cast<uint64_t>(value));
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_floating_point<T>::value>::type encode(const T& value) {
+			append(tag::floating, static_cast<double>(value));
+		}
+
+		template<typename T>
+		typename std::enable_if<!std::is_arithmetic<T>::value>::type encode(const T& value) {
+			std::ostringstream ss;
+			ss << value;
+			encode(ss.str());
+		}
+
+		template<typename T>
+		T read(size_t& pos) const {
+			T res;
+			if (pos + sizeof(T) > m_data.size())
+				throw std::runtime_error("invalid log arguments");
+			memcpy(&res, m_data.data() + pos, sizeof(T));
+			pos += sizeof(T);
+			return res;
+		}
+
+		// Append the argument at pos to out and advance pos
+		void format_arg(std::string& out, size_t& pos) const {
+			char buf[32];
+			const auto t = static_cast<tag>(read<uint8_t>(pos));
+			switch (t) {
+			case tag::boolean: out += read<uint8_t>(pos) ? '1' : '0'; break;
+			case tag::character: out += read<char>(pos); break;
+			case tag::int64: out += std::to_string(read<int64_t>(pos)); break;
+			case tag::uint64: out += std::to_string(read<uint64_t>(pos)); break;
+			case tag::floating:
+				// Same output as operator<< with default precision
+				snprintf(buf, sizeof(buf), "%g", read<double>(pos));
+				out += buf;
+				break;
+			case tag::string: {
+				const auto len = read<uint32_t>(pos);
+				if (pos + len > m_data.size())
+					throw std::runtime_error("invalid log arguments");
+				out.append(reinterpret_cast<const char*>(m_data.data() + pos), len);
+				pos += len;
+				break;
+			}
+			default: throw std::runtime_error("invalid log arguments");
+			}
+		}
+	public:
+		void clear() {
+			m_data.clear();
+			m_count = 0;
+		}
+
+		void add() {}
+
+		template<typename T, typename... Rest>
+		void add(const T& value, const Rest&... rest) {
+			encode(value);
+			add(rest...);
+		}
+
+		const uint8_t* data() const { return m_data.data(); }
+		size_t size() const { return m_data.size(); }
+		size_t count() const { return m_count; }
+		bool empty() const { return m_count == 0; }
+
+		// Replace the content with previously captured data (e.g. read from a binary log), capacity is retained
+		void assign(const uint8_t* data, size_t len, size_t count) {
+			m_data.assign(data, data + len);
+			m_count = count;
+		}
+
+		void assign(const log_args& other) {
+			assign(other.data(), other.size(), other.count());
+		}
+
+		void format_to(std::string& out, const char* fmt) const {
+			size_t pos = 0;
+			for (; *fmt != '\0'; fmt++) {
+				if (fmt[0] == '{' && fmt[1] == '}' && pos < m_data.size()) {
+					format_arg(out, pos);
+					fmt++;
+				} else {
+					out += *fmt;
+				}
+			}
+			while (pos < m_data.size()) {
+				out += ' ';
+				format_arg(out, pos);
+			}
+		}
+
+		std::string format(const char* fmt) const {
+			std::string res;
+			format_to(res, fmt);
+			return res;
+		}
+	};
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif
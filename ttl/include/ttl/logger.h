@@ -7,6 +7,41 @@
 #include <chrono>
 #include <atomic>
 #include <functional>
+#include <type_traits>
+#include <limits>
+#include <bitset>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+#include "log_args.h"
+
+// Messages below this level (as int, TRACE = 0 ... ERR = 4) are removed at compile time by the TTL_LOG macros
+#ifndef TTL_LOG_MIN_LEVEL
+#define TTL_LOG_MIN_LEVEL 0
+#endif
+
+// Maximum number of distinct logmodule names, modules beyond this share the global level
+#ifndef TTL_LOG_MAX_MODULES
+#define TTL_LOG_MAX_MODULES 256
+#endif
+
+/**
+ * Log a formatted message (see logger::logf) if the level is enabled.
+ * Arguments are not evaluated for disabled levels and statements below the compile time minimum level
+ * (TTL_LOG_MIN_LEVEL or the MinLevel of a static_logger) are removed completely.
+ */
+#define TTL_LOG(log, lvl, module, ...) \
+	do { \
+		if (static_cast<int>(lvl) >= TTL_LOG_MIN_LEVEL \
+			&& (lvl) >= std::remove_reference<decltype(log)>::type::min_level \
+			&& (log).is_enabled((lvl), (module))) \
+			(log).logf((lvl), (module), __VA_ARGS__); \
+	} while (false)
+#define TTL_TRACE(log, module, ...) TTL_LOG(log, ::ttl::loglevel::TRACE, module, __VA_ARGS__)
+#define TTL_DEBUG(log, module, ...) TTL_LOG(log, ::ttl::loglevel::DEBUG, module, __VA_ARGS__)
+#define TTL_INFO(log, module, ...) TTL_LOG(log, ::ttl::loglevel::INFO, module, __VA_ARGS__)
+#define TTL_WARN(log, module, ...) TTL_LOG(log, ::ttl::loglevel::WARN, module, __VA_ARGS__)
+#define TTL_ERROR(log, module, ...) TTL_LOG(log, ::ttl::loglevel::ERR, module, __VA_ARGS__)
 
 namespace ttl {
 	// A threadsafe logger implementation replacement for std::cout
@@ -18,29 +53,141 @@ namespace ttl {
 		WARN,
 		ERR
 	};
+	/**
+	 * Global table mapping module names to small integer ids.
+	 * Id 0 is used for modules that did not fit into the table, they always use the global level of a logger.
+	 */
+	class module_registry {
+		mutable std::mutex m_mtx;
+		std::unordered_map<std::string, size_t> m_ids;
+		std::vector<std::string> m_names;
+
+		module_registry()
+			: m_names(1)
+		{}
+	public:
+		static constexpr size_t max_modules = TTL_LOG_MAX_MODULES;
+
+		static module_registry& instance() {
+			static module_registry registry;
+			return registry;
+		}
+
+		// Get the id of name, registering it if needed
+		size_t intern(const std::string& name) {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			auto it = m_ids.find(name);
+			if (it != m_ids.end())
+				return it->second;
+			if (m_names.size() >= max_modules)
+				return 0;
+			const auto id = m_names.size();
+			m_names.push_back(name);
+			m_ids.emplace(name, id);
+			return id;
+		}
+
+		// Get the id of name without registering it, 0 if it is unknown
+		size_t find(const std::string& name) const {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			auto it = m_ids.find(name);
+			return it != m_ids.end() ? it->second : 0;
+		}
+
+		std::string get_name(size_t id) const {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			return id < m_names.size() ? m_names[id] : std::string();
+		}
+
+		size_t size() const {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			return m_names.size();
+		}
+	};
+
+	// Module name interned into an id on construction, define it once (e.g. static) and reuse it for cheap per module filtering
 	struct logmodule {
 		std::string name;
-		explicit logmodule(std::string n) : name(n) {}
+		size_t id;
+		explicit logmodule(std::string n) : name(std::move(n)), id(module_registry::instance().intern(name)) {}
 	};
 	class logger {
+		friend class async_logger;
+	public:
+		// Messages below this level are removed at compile time by the TTL_LOG macros, see static_logger
+		static constexpr loglevel min_level = loglevel::TRACE;
+	private:
+
 		std::atomic<loglevel> m_level;
+		// Effective level of every module id, modules without their own level mirror m_level
+		std::atomic<loglevel> m_module_levels[module_registry::max_modules];
+		std::bitset<module_registry::max_modules> m_module_overrides;
+		// Allows log() to skip the mutex if no check function is set
+		std::atomic<bool> m_has_check_fn;
 		mutable std::mutex m_mtx;
 		std::function<bool(loglevel, const std::string&, const std::string&)> m_check_fn;
+
+		bool passes_check(loglevel l, const std::string& module, const std::string& message) const
+		{
+			if (m_has_check_fn) {
+				std::unique_lock<std::mutex> lck(m_mtx);
+				if(m_check_fn && !m_check_fn(l, module, message))
+					return false;
+			}
+			return true;
+		}
+
+		// Level filter for messages forwarded by name (e.g. by async_logger), uses the level of the module if it is registered
+		bool is_forward_enabled(loglevel l, const std::string& module) const
+		{
+			return l >= m_module_levels[module_registry::instance().find(module)].load(std::memory_order_relaxed);
+		}
+
+		void write_checked(loglevel l, const std::string& module, const std::string& message)
+		{
+			if (passes_check(l, module, message))
+				this->write(l,module, message);
+		}
+
+		template<typename... Args>
+		void write_formatted(loglevel l, const std::string& module, const char* fmt, const Args&... args)
+		{
+			static thread_local log_args buf;
+			buf.clear();
+			buf.add(args...);
+			if (m_has_check_fn) {
+				write_checked(l, module, buf.format(fmt));
+				return;
+			}
+			this->write_args(l, module, fmt, buf);
+		}
 	protected:
 		virtual void write(loglevel l, const std::string& module, const std::string& msg) = 0;
+		// Write a message created at time tp, sinks that print the time should override this
+		virtual void write_at(loglevel l, const std::string& module, const std::string& msg, std::chrono::system_clock::time_point tp) {
+			(void)tp;
+			write(l, module, msg);
+		}
+		// Write a message with deferred formatting, sinks able to store or forward the arguments should override this
+		virtual void write_args(loglevel l, const std::string& module, const char* fmt, const log_args& args) {
+			write(l, module, args.format(fmt));
+		}
 	public:
 		typedef std::function<bool(loglevel l, const std::string& module, const std::string& message)> check_function_t;
 		logger()
+			: m_has_check_fn(false)
 		{
 			set_loglevel(loglevel::INFO);
 		}
 
 		explicit logger(loglevel level)
+			: m_has_check_fn(false)
 		{
 			set_loglevel(level);
 		}
 
 		logger(loglevel level, check_function_t fn)
+			: m_has_check_fn(false)
 		{
 			set_loglevel(level);
 			set_check_function(fn);
@@ -49,16 +196,58 @@ namespace ttl {
 		virtual ~logger() {}
 
 		void set_loglevel(loglevel l) {
+			std::unique_lock<std::mutex> lck(m_mtx);
 			m_level = l;
+			for (size_t i = 0; i < module_registry::max_modules; i++) {
+				if (!m_module_overrides[i])
+					m_module_levels[i].store(l, std::memory_order_relaxed);
+			}
 		}
 
 		loglevel get_loglevel() {
 			return m_level;
 		}
 
+		// Set the level of a single module, overriding the global level
+		void set_loglevel(const logmodule& module, loglevel l) {
+			if (module.id == 0)
+				return;
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_module_overrides[module.id] = true;
+			m_module_levels[module.id].store(l, std::memory_order_relaxed);
+		}
+
+		// Let the module follow the global level again
+		void reset_loglevel(const logmodule& module) {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			m_module_overrides[module.id] = false;
+			m_module_levels[module.id].store(m_level, std::memory_order_relaxed);
+		}
+
+		loglevel get_loglevel(const logmodule& module) const {
+			return m_module_levels[module.id].load(std::memory_order_relaxed);
+		}
+
+		// Cheap check if a message at level l would pass the level filter
+		bool is_enabled(loglevel l) const {
+			return l >= m_level.load(std::memory_order_relaxed);
+		}
+
+		// Check against the level of module, a single relaxed load
+		bool is_enabled(loglevel l, const logmodule& module) const {
+			return l >= m_module_levels[module.id].load(std::memory_order_relaxed);
+		}
+
+		// Modules given by name are not interned and use the global level
+		template<typename T>
+		bool is_enabled(loglevel l, const T&) const {
+			return is_enabled(l);
+		}
+
 		void set_check_function(check_function_t fn) {
 			std::unique_lock<std::mutex> lck(m_mtx);
 			m_check_fn = fn;
+			m_has_check_fn = static_cast<bool>(m_check_fn);
 		}
 
 		check_function_t get_check_function() const {
@@ -68,16 +257,39 @@ namespace ttl {
 
 		void log(loglevel l, const std::string& module, const std::string& message)
 		{
-			if (l >= m_level) {
-				{
-					std::unique_lock<std::mutex> lck(m_mtx);
-					if(m_check_fn && !m_check_fn(l, module, message))
-						return;
-				}
-				this->write(l,module, message);
-			}
+			if (is_enabled(l))
+				write_checked(l, module, message);
+		}
+
+		void log(loglevel l, const logmodule& module, const std::string& message)
+		{
+			if (is_enabled(l, module))
+				write_checked(l, module.name, message);
+		}
+
+		/**
+		 * Log a message built from a format string and arguments, every "{}" is replaced by the next argument.
+		 * The arguments are only captured in binary form, formatting is up to the sink (e.g. the background thread of async_logger).
+		 * fmt needs to stay valid for the lifetime of the logger (usually a string literal).
+		 * If a check function is set the message needs to be formatted immediately.
+		 */
+		template<typename... Args>
+		void logf(loglevel l, const std::string& module, const char* fmt, const Args&... args)
+		{
+			if (is_enabled(l))
+				write_formatted(l, module, fmt, args...);
 		}
 
+		template<typename... Args>
+		void logf(loglevel l, const logmodule& module, const char* fmt, const Args&... args)
+		{
+			if (is_enabled(l, module))
+				write_formatted(l, module.name, fmt, args...);
+		}
+
+		// Write out any output buffered by the sink
+		virtual void flush() {}
+
 		void trace(const std::string& module, const std::string& message) { log(loglevel::TRACE, module, message); }
 		void debug(const std::string& module, const std::string& message) { log(loglevel::DEBUG, module, message); }
 		void info(const std::string& module, const std::string& message) { log(loglevel::INFO, module, message); }
@@ -88,8 +300,18 @@ namespace ttl {
 			loglevel level = loglevel::INFO;
 			loglevel level_output;
 			std::string module;
-			std::ostringstream str;
+			// Only constructed once something is written at an enabled level
+			typename std::aligned_storage<sizeof(std::ostringstream), alignof(std::ostringstream)>::type str_storage;
+			bool has_str = false;
 			logger* log;
+
+			std::ostringstream& str() {
+				if (!has_str) {
+					new (&str_storage) std::ostringstream();
+					has_str = true;
+				}
+				return *reinterpret_cast<std::ostringstream*>(&str_storage);
+			}
 		public:
 			typedef std::shared_ptr<stream> ptr;
 			explicit stream(logger* l) {
@@ -103,12 +325,12 @@ namespace ttl {
 				level_output = log->get_loglevel(); // Safe loglevel at creation
 				level = level_output;
 				if (level >= level_output) {
-					str << e;
+					str() << e;
 				}
 			}
 			stream(logger* l, const logmodule& e) {
 				log = l;
-				level_output = log->get_loglevel(); // Safe loglevel at creation
+				level_output = log->get_loglevel(e); // Safe loglevel at creation
 				level = level_output;
 				module = e.name;
 			}
@@ -118,15 +340,27 @@ namespace ttl {
 				level = e;
 			}
 			stream(logger* l, const logmodule& e, const loglevel& lvl) {
+				log = l;
+				level_output = log->get_loglevel(e); // Safe loglevel at creation
+				level = lvl;
+				if (level >= level_output)
+					module = e.name;
+			}
+			stream(logger* l, const std::string& m, const loglevel& lvl) {
 				log = l;
 				level_output = log->get_loglevel(); // Safe loglevel at creation
 				level = lvl;
-				module = e.name;
+				if (level >= level_output)
+					module = m;
 			}
 			stream(const stream&) = delete;
 			stream(stream&&) = delete;
 			~stream() {
-				log->log(level, module, str.str());
+				// Level was already checked against the global or module level
+				if (level >= level_output)
+					log->write_checked(level, module, has_str ? str().str() : std::string());
+				if (has_str)
+					str().~basic_ostringstream();
 			}
 			loglevel get_loglevel() {
 				return level;
@@ -140,6 +374,7 @@ namespace ttl {
 		};
 
 		stream operator()(loglevel lvl, const std::string& module);
+		stream operator()(loglevel lvl, const logmodule& module);
 	};
 
 	template<typename T>
@@ -154,7 +389,11 @@ namespace ttl {
 	}
 
 	inline logger::stream logger::operator()(loglevel lvl, const std::string& module) {
-		return {this, logmodule(module), lvl};
+		return {this, module, lvl};
+	}
+
+	inline logger::stream logger::operator()(loglevel lvl, const logmodule& module) {
+		return {this, module, lvl};
 	}
 
 	template<typename T>
@@ -162,7 +401,7 @@ namespace ttl {
 	{
 		auto& e = const_cast<logger::stream&>(lhs);
 		if (e.level >= e.level_output) {
-			e.str << rhs;
+			e.str() << rhs;
 		}
 		return lhs;
 	}
@@ -171,6 +410,7 @@ namespace ttl {
 	{
 		auto& e = const_cast<logger::stream&>(lhs);
 		e.module = rhs.name;
+		e.level_output = e.log->get_loglevel(rhs);
 		return lhs;
 	}
 
@@ -181,36 +421,165 @@ namespace ttl {
 		return lhs;
 	}
 
+	/**
+	 * Reference to a logger with a compile time minimum level.
+	 * Messages below MinLevel are discarded without any runtime check and TTL_LOG statements using it are removed entirely.
+	 */
+	template<loglevel MinLevel>
+	class static_logger {
+		logger& m_log;
+	public:
+		static constexpr loglevel min_level = MinLevel;
+
+		explicit static_logger(logger& log)
+			: m_log(log)
+		{}
+
+		logger& get_logger() { return m_log; }
+
+		bool is_enabled(loglevel l) const {
+			return l >= MinLevel && m_log.is_enabled(l);
+		}
+
+		template<typename Module>
+		bool is_enabled(loglevel l, const Module& module) const {
+			return l >= MinLevel && m_log.is_enabled(l, module);
+		}
+
+		void log(loglevel l, const std::string& module, const std::string& message) {
+			if (l >= MinLevel)
+				m_log.log(l, module, message);
+		}
+
+		void log(loglevel l, const logmodule& module, const std::string& message) {
+			if (l >= MinLevel)
+				m_log.log(l, module, message);
+		}
+
+		template<typename... Args>
+		void logf(loglevel l, const std::string& module, const char* fmt, const Args&... args) {
+			if (l >= MinLevel)
+				m_log.logf(l, module, fmt, args...);
+		}
+
+		template<typename... Args>
+		void logf(loglevel l, const logmodule& module, const char* fmt, const Args&... args) {
+			if (l >= MinLevel)
+				m_log.logf(l, module, fmt, args...);
+		}
+	};
+
 	class streamlogger: public logger {
+	public:
+		// How the timestamp at the start of each line is generated
+		enum class timestamp_mode {
+			// Local time formatted using the time format
+			local,
+			// UTC formatted using the time format
+			utc,
+			// Seconds of the steady clock (e.g. uptime), useful to measure intervals
+			monotonic,
+			// Nanoseconds since the unix epoch
+			epoch_ns
+		};
+	private:
 		std::ostream& ostream;
 		std::atomic<bool> autoflush;
 		std::string time_format = "%c";
+		timestamp_mode mode = timestamp_mode::local;
+		unsigned int subsecond_digits = 0;
 		mutable std::mutex mtx;
+		// Formatted time of cached_second, only redone if the second changes
+		int64_t cached_second = std::numeric_limits<int64_t>::min();
+		std::string cached_time;
+		std::string line;
 
-		void write(loglevel l, const std::string& module, const std::string& message) override
-		{
-			std::string strlevel = "?????";
+		static const char* level_string(loglevel l) {
 			switch (l) {
-			case loglevel::ERR: strlevel = "ERROR"; break;
-			case loglevel::WARN: strlevel = "WARN "; break;
-			case loglevel::INFO: strlevel = "INFO "; break;
-			case loglevel::DEBUG: strlevel = "DEBUG"; break;
-			case loglevel::TRACE: strlevel = "TRACE"; break;
+			case loglevel::ERR: return "ERROR";
+			case loglevel::WARN: return "WARN ";
+			case loglevel::INFO: return "INFO ";
+			case loglevel::DEBUG: return "DEBUG";
+			case loglevel::TRACE: return "TRACE";
+			}
+			return "?????";
+		}
+
+		// Append the fractional part of ns using the configured number of digits
+		void append_subsecond(int64_t ns) {
+			if (subsecond_digits == 0)
+				return;
+			char buf[10];
+			auto frac = static_cast<uint32_t>(ns % 1000000000);
+			for (unsigned int i = subsecond_digits; i < 9; i++)
+				frac /= 10;
+			for (unsigned int i = subsecond_digits; i > 0; i--) {
+				buf[i - 1] = static_cast<char>('0' + frac % 10);
+				frac /= 10;
+			}
+			line += '.';
+			line.append(buf, subsecond_digits);
+		}
+
+		void append_time(std::chrono::system_clock::time_point tp) {
+			using namespace std::chrono;
+			if (mode == timestamp_mode::epoch_ns) {
+				line += std::to_string(duration_cast<nanoseconds>(tp.time_since_epoch()).count());
+				return;
+			}
+			if (mode == timestamp_mode::monotonic) {
+				// Move the (possibly queued) timestamp onto the steady clock
+				const auto ns = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch() - (system_clock::now() - tp)).count();
+				line += std::to_string(ns / 1000000000);
+				append_subsecond(ns);
+				return;
+			}
+			// Floor to full seconds, so times before the epoch do not use the wrong second
+			auto ns = duration_cast<nanoseconds>(tp.time_since_epoch()).count();
+			auto sec = ns / 1000000000;
+			if (ns % 1000000000 < 0) {
+				sec--;
+				ns = ns % 1000000000 + 1000000000;
 			}
-			time_t nt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-			struct tm t;
+			if (sec != cached_second) {
+				time_t nt = static_cast<time_t>(sec);
+				struct tm t;
 #ifdef _WIN32
-			localtime_s(&t, &nt);
+				if (mode == timestamp_mode::utc) gmtime_s(&t, &nt);
+				else localtime_s(&t, &nt);
 #else
-			localtime_r(&nt, &t);
+				if (mode == timestamp_mode::utc) gmtime_r(&nt, &t);
+				else localtime_r(&nt, &t);
 #endif
-			{
-				std::unique_lock<std::mutex> lck(mtx);
-				ostream << std::put_time(&t, time_format.c_str()) << " | " << strlevel << " | " << module << " | " << message << std::endl;
-				if(autoflush)
-					ostream.flush();
+				std::ostringstream ss;
+				ss << std::put_time(&t, time_format.c_str());
+				cached_time = ss.str();
+				cached_second = sec;
 			}
-			
+			line += cached_time;
+			append_subsecond(ns);
+		}
+
+		void write(loglevel l, const std::string& module, const std::string& message) override
+		{
+			write_at(l, module, message, std::chrono::system_clock::now());
+		}
+	protected:
+		void write_at(loglevel l, const std::string& module, const std::string& message, std::chrono::system_clock::time_point tp) override
+		{
+			std::unique_lock<std::mutex> lck(mtx);
+			line.clear();
+			append_time(tp);
+			line += " | ";
+			line += level_string(l);
+			line += " | ";
+			line += module;
+			line += " | ";
+			line += message;
+			line += '\n';
+			ostream.write(line.data(), line.size());
+			if(autoflush)
+				ostream.flush();
 		}
 	public:
 		typedef std::function<bool(loglevel l, const std::string& module, const std::string& message)> check_function_t;
@@ -223,11 +592,18 @@ namespace ttl {
 		streamlogger(std::ostream& stream, loglevel level)
 			: logger(level), ostream(stream)
 		{
+			set_autoflush(true);
 		}
 
 		streamlogger(std::ostream& stream, loglevel level, check_function_t fn)
 			: logger(level, fn), ostream(stream)
 		{
+			set_autoflush(true);
+		}
+
+		void flush() override {
+			std::unique_lock<std::mutex> lck(mtx);
+			ostream.flush();
 		}
 
 		void set_autoflush(bool b) {
@@ -245,12 +621,35 @@ namespace ttl {
 		void set_timeformat(std::string str) {
 			std::unique_lock<std::mutex> lck(mtx);
 			time_format = std::move(str);
+			cached_second = std::numeric_limits<int64_t>::min();
 		}
 
 		std::string get_timeformat() const {
 			std::unique_lock<std::mutex> lck(mtx);
 			return time_format;
 		}
+
+		void set_timestamp_mode(timestamp_mode m) {
+			std::unique_lock<std::mutex> lck(mtx);
+			mode = m;
+			cached_second = std::numeric_limits<int64_t>::min();
+		}
+
+		timestamp_mode get_timestamp_mode() const {
+			std::unique_lock<std::mutex> lck(mtx);
+			return mode;
+		}
+
+		// Number of fractional second digits (0 - 9) appended to local, utc and monotonic timestamps
+		void set_subsecond_digits(unsigned int digits) {
+			std::unique_lock<std::mutex> lck(mtx);
+			subsecond_digits = digits > 9 ? 9 : digits;
+		}
+
+		unsigned int get_subsecond_digits() const {
+			std::unique_lock<std::mutex> lck(mtx);
+			return subsecond_digits;
+		}
 	};
 }
 
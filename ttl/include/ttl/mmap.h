@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <stdexcept>
+#include <cstdint>
 #ifdef _WIN32
 #include <Windows.h>
 #else
@@ -14,6 +15,12 @@
 
 namespace ttl {
 	class mmap {
+	public:
+		enum class access {
+			read_only,
+			read_write
+		};
+	private:
 #ifdef _WIN32
 		HANDLE _file;
 		HANDLE _mapped;
@@ -21,26 +28,35 @@ namespace ttl {
 		int _file;
 #endif
 		uint64_t _filesize;
+		uint64_t _view_offset;
 		uint64_t _view_size;
-		const void* _view;
+		void* _view;
+		access _access;
+
+#ifdef _WIN32
+		bool create_mapping() {
+			_mapped = ::CreateFileMappingA(_file, NULL, _access == access::read_write ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+			return _mapped != nullptr;
+		}
+#endif
 	public:
 		mmap& operator=(const mmap& o) = delete;
 		mmap(const mmap& o) = delete;
 
 #ifdef _WIN32
 		mmap()
-			: _file(nullptr), _mapped(nullptr), _filesize(0), _view_size(0), _view(nullptr)
+			: _file(nullptr), _mapped(nullptr), _filesize(0), _view_offset(0), _view_size(0), _view(nullptr), _access(access::read_only)
 		{}
 #else
 		mmap()
-			: _file(-1), _filesize(0), _view_size(0), _view(nullptr)
+			: _file(-1), _filesize(0), _view_offset(0), _view_size(0), _view(nullptr), _access(access::read_only)
 		{}
 #endif
 
-		explicit mmap(const std::string& fname)
+		explicit mmap(const std::string& fname, access mode = access::read_only)
 			: mmap()
 		{
-			if (!open(fname))
+			if (!open(fname, mode))
 				throw std::runtime_error("failed to open file");
 		}
 
@@ -48,12 +64,22 @@ namespace ttl {
 			close();
 		}
 
-		bool open(const std::string& fname) {
+		/**
+		 * Open and map a file.
+		 * With access::read_write the file is created if it does not exist.
+		 * An empty file can not be mapped, in read_write mode it stays open
+		 * without a view until it is grown using resize().
+		 */
+		bool open(const std::string& fname, access mode = access::read_only) {
 			close();
+			_access = mode;
 #ifdef _WIN32
-			_file = ::CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-			if (!_file)
+			const bool rw = mode == access::read_write;
+			_file = ::CreateFileA(fname.c_str(), rw ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ, NULL, rw ? OPEN_ALWAYS : OPEN_EXISTING, 0, NULL);
+			if (!_file || _file == INVALID_HANDLE_VALUE) {
+				_file = nullptr;
 				return false;
+			}
 			// file size
 			LARGE_INTEGER result;
 			if (!GetFileSizeEx(_file, &result)) {
@@ -62,22 +88,21 @@ namespace ttl {
 				return false;
 			}
 			_filesize = static_cast<uint64_t>(result.QuadPart);
+			if (_filesize == 0 && rw)
+				return true;
 
 			// convert to mapped mode
-			_mapped = ::CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
-			if (!_mapped) {
+			if (!create_mapping()) {
 				CloseHandle(_file);
 				_file = nullptr;
 				_filesize = 0;
 				return false;
 			}
 #else
-			_file = ::open(fname.c_str(), O_RDONLY | O_LARGEFILE);
+			const int flags = mode == access::read_write ? (O_RDWR | O_CREAT) : O_RDONLY;
+			_file = ::open(fname.c_str(), flags | O_LARGEFILE, 0644);
 			if (_file == -1)
-			{
-				_file = 0;
 				return false;
-			}
 
 			// file size
 			struct stat64 statInfo;
@@ -85,6 +110,8 @@ namespace ttl {
 				return false;
 
 			_filesize = static_cast<uint64_t>(statInfo.st_size);
+			if (_filesize == 0 && mode == access::read_write)
+				return true;
 #endif
 			// initial mapping
 			remap(0, 0);
@@ -102,10 +129,12 @@ namespace ttl {
 #ifdef _WIN32
 				::UnmapViewOfFile(_view);
 #else
-				::munmap(const_cast<void*>(_view), _filesize);
+				::munmap(_view, _view_size);
 #endif
 				_view = nullptr;
 			}
+			_view_offset = 0;
+			_view_size = 0;
 
 #ifdef _WIN32
 			if (_mapped)
@@ -130,10 +159,27 @@ namespace ttl {
 			_filesize = 0;
 		}
 
+		bool is_open() const {
+#ifdef _WIN32
+			return _file != nullptr;
+#else
+			return _file != -1;
+#endif
+		}
+
 		bool is_valid() const {
 			return _view != nullptr;
 		}
 
+		bool is_writable() const {
+			return _access == access::read_write;
+		}
+
+		/**
+		 * Replace the current view by one starting at offset.
+		 * offset needs to be a multiple of page_size(), len == 0 maps until the end of the file.
+		 * For scanning files larger than the address budget use windowed_mmap instead.
+		 */
 		bool remap(size_t offset, size_t len) {
 			// don't go further than end of file
 			if (offset > _filesize)
@@ -158,9 +204,10 @@ namespace ttl {
 #else
 			DWORD offsetHigh = 0;
 #endif
-			_view = ::MapViewOfFile(_mapped, FILE_MAP_READ, offsetHigh, offsetLow, len);
+			_view = ::MapViewOfFile(_mapped, _access == access::read_write ? FILE_MAP_WRITE : FILE_MAP_READ, offsetHigh, offsetLow, len);
 			if (_view == nullptr)
 				return false;
+			_view_offset = offset;
 			_view_size = len;
 
 #else
@@ -169,30 +216,141 @@ namespace ttl {
 
 			if (_view)
 			{
-				::munmap(const_cast<void*>(_view), _view_size);
+				::munmap(_view, _view_size);
 				_view = nullptr;
 				_view_size = 0;
 			}
 
-			_view = ::mmap64(nullptr, len, PROT_READ, MAP_SHARED, _file, static_cast<loff_t>(offset));
+			const int prot = _access == access::read_write ? (PROT_READ | PROT_WRITE) : PROT_READ;
+			_view = ::mmap64(nullptr, len, prot, MAP_SHARED, _file, static_cast<loff_t>(offset));
 			if (_view == MAP_FAILED)
 			{
 				_view = nullptr;
 				return false;
 			}
+			_view_offset = offset;
 			_view_size = len;
 #endif
 			return true;
 		}
 
+		/**
+		 * Change the size of a file opened with access::read_write.
+		 * Afterwards the whole file is mapped, so pointers obtained by data() are invalidated.
+		 * On linux the existing view is moved using mremap which avoids tearing down the page tables.
+		 */
+		bool resize(uint64_t size) {
+			if (!is_open() || !is_writable())
+				return false;
+#ifdef _WIN32
+			// A file can not be resized while a mapping exists
+			if (_view)
+			{
+				::UnmapViewOfFile(_view);
+				_view = nullptr;
+				_view_size = 0;
+			}
+			if (_mapped)
+			{
+				::CloseHandle(_mapped);
+				_mapped = NULL;
+			}
+			LARGE_INTEGER pos;
+			pos.QuadPart = static_cast<LONGLONG>(size);
+			if (!::SetFilePointerEx(_file, pos, NULL, FILE_BEGIN) || !::SetEndOfFile(_file))
+				return false;
+			_filesize = size;
+			if (size == 0)
+				return true;
+			if (!create_mapping())
+				return false;
+#else
+			if (::ftruncate64(_file, static_cast<off64_t>(size)) != 0)
+				return false;
+			_filesize = size;
+			if (size == 0)
+			{
+				if (_view)
+				{
+					::munmap(_view, _view_size);
+					_view = nullptr;
+					_view_size = 0;
+				}
+				return true;
+			}
+#ifdef MREMAP_MAYMOVE
+			if (_view && _view_offset == 0)
+			{
+				void* view = ::mremap(_view, _view_size, size, MREMAP_MAYMOVE);
+				if (view != MAP_FAILED)
+				{
+					_view = view;
+					_view_size = size;
+					return true;
+				}
+			}
+#endif
+#endif
+			return remap(0, 0);
+		}
+
+		/**
+		 * Write modified pages of the current view back to disk.
+		 * If async is true the writeback is only scheduled.
+		 */
+		bool flush(bool async = false) {
+			return flush(0, size(), async);
+		}
+
+		bool flush(size_t offset, size_t len, bool async = false) {
+			if (!_view || offset > _view_size)
+				return false;
+			if (offset + len > _view_size || len == 0)
+				len = size_t(_view_size - offset);
+#ifdef _WIN32
+			if (!::FlushViewOfFile(data() + offset, len))
+				return false;
+			return async || ::FlushFileBuffers(_file);
+#else
+			// msync requires a page aligned address
+			const size_t align = offset % page_size();
+			return ::msync(data() + offset - align, len + align, async ? MS_ASYNC : MS_SYNC) == 0;
+#endif
+		}
+
+		/**
+		 * Granularity of mapping offsets.
+		 */
+		static size_t page_size() {
+#ifdef _WIN32
+			SYSTEM_INFO info;
+			::GetSystemInfo(&info);
+			return static_cast<size_t>(info.dwAllocationGranularity);
+#else
+			return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+#endif
+		}
+
 		const uint8_t& operator[](size_t idx) const {
 			return reinterpret_cast<const uint8_t*>(_view)[idx];
 		}
 
+		uint8_t& operator[](size_t idx) {
+			return reinterpret_cast<uint8_t*>(_view)[idx];
+		}
+
 		const uint8_t& at(size_t idx) const {
 			if (!is_valid())
 				throw std::runtime_error("no file mapped");
-			if (idx > _view_size)
+			if (idx >= _view_size)
+				throw std::out_of_range("invalid idx");
+			return operator[](idx);
+		}
+
+		uint8_t& at(size_t idx) {
+			if (!is_valid())
+				throw std::runtime_error("no file mapped");
+			if (idx >= _view_size)
 				throw std::out_of_range("invalid idx");
 			return operator[](idx);
 		}
@@ -201,9 +359,18 @@ namespace ttl {
 			return reinterpret_cast<const uint8_t*>(_view);
 		}
 
+		// Only valid to write to if the file was opened with access::read_write
+		uint8_t* data() {
+			return reinterpret_cast<uint8_t*>(_view);
+		}
+
 		size_t size() const {
 			return static_cast<size_t>(_view_size);
 		}
+
+		uint64_t file_size() const {
+			return _filesize;
+		}
 	};
 }
 
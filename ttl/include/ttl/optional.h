@@ -1,4 +1,7 @@
 #pragma once
+#include <cstring>
+#include <cstdint>
+#include <new>
 
 namespace ttl
 {
@@ -4,7 +4,20 @@
 #include <type_traits>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <stdexcept>
 #include "optional.h"
+#include "executor.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define TTL_HAS_COROUTINES 1
+#endif
+#endif
 
 namespace ttl {
     enum class promise_state {
@@ -13,202 +26,553 @@ namespace ttl {
         rejected
     };
 	template<typename T>
-	class promise {
+	class promise;
+#ifdef TTL_HAS_COROUTINES
+	template<typename T>
+	class task;
+#endif
+
+    // Outcome of a single promise passed to promise::all_settled()
+    template<typename T>
+    struct settled_result {
+        promise_state status = promise_state::pending;
+        optional<T> value;
+        std::exception_ptr error;
+    };
+
+    // Rejection of promise::any() if no promise was resolved, contains the errors in order of the passed promises
+    struct aggregate_error : std::runtime_error {
+        std::vector<std::exception_ptr> errors;
+
+        explicit aggregate_error(std::vector<std::exception_ptr> errs)
+            : std::runtime_error("all promises were rejected"), errors(std::move(errs))
+        {}
+    };
+
+    namespace detail {
+        // Value type of the promise returned by then(), continuations returning a promise are flattened
+        // and continuations returning void pass the value on
+        template<typename T, typename R>
+        struct then_result { typedef R type; };
+        template<typename T>
+        struct then_result<T, void> { typedef T type; };
+        template<typename T, typename U>
+        struct then_result<T, std::shared_ptr<promise<U>>> { typedef U type; };
+    }
+
+	template<typename T>
+	class promise : public std::enable_shared_from_this<promise<T>> {
     protected:
-        promise() {}
+        promise()
+            : m_state(state::pending), m_claimed(false), m_continuations(nullptr), m_waiters(0)
+        {}
         promise(const promise&) = delete;
         promise(promise&&) = delete;
         template<typename U>
         friend class promise;
+#ifdef TTL_HAS_COROUTINES
+        template<typename U>
+        friend class task;
+#endif
 	public:
         typedef promise_state state;
 		typedef std::shared_ptr<promise> ptr;
         typedef std::function<void(T)> resolve_fn_t;
         typedef std::function<void(std::exception_ptr)> reject_fn_t;
         typedef std::function<void(resolve_fn_t, reject_fn_t)> executor_fn_t;
-        
+
+        ~promise() {
+            auto c = m_continuations.load();
+            while (c != nullptr && c != closed()) {
+                auto next = c->next;
+                delete c;
+                c = next;
+            }
+        }
+
         static ptr create(executor_fn_t fn) {
+            auto res = std::shared_ptr<promise>(new promise());
+            run(res, fn);
+            return res;
+        }
+        // Like create(fn), but fn is posted to ex instead of running on the calling thread
+        static ptr create(executor_fn_t fn, const executor_t& ex) {
             auto res = std::shared_ptr<promise>(new promise());
             try {
-                fn([res](T val){
-                    res->do_resolve(std::move(val));
-                }, [res](std::exception_ptr err){
-                    res->do_reject(std::move(err));
-                });
+                ex([res, fn]() { run(res, fn); });
             } catch(...) {
-                res->do_reject(std::current_exception());
+                res->try_reject(std::current_exception());
             }
             return res;
         }
 
-        void then(resolve_fn_t fn) {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state == state::pending) {
-                m_resolve_list.push_back(fn);
-            } else if(m_state == state::resolved) {
-                fn(m_value.value());
-            }
+        /**
+         * Call fn once the promise is resolved and return a promise for its result.
+         * If fn returns a promise, the returned promise follows it. If fn returns void, the returned promise
+         * resolves with the value of this promise after fn ran. Rejections and exceptions thrown by fn reject the returned promise.
+         */
+        template<typename Func>
+        auto then(Func fn) -> typename promise<typename detail::then_result<T, decltype(fn(std::declval<T&>()))>::type>::ptr {
+            return chain(std::move(fn), reject_fn_t());
         }
-        void then(resolve_fn_t fn, reject_fn_t err) {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state == state::pending) {
-                m_resolve_list.push_back(fn);
-                m_reject_list.push_back(err);
-            } else if(m_state == state::resolved) {
-                fn(m_value.value());
-            } else if(m_state == state::rejected) {
-                err(m_error);
-            }
+        // Like then(fn), err is called if this promise is rejected, the returned promise is rejected with the same error
+        template<typename Func>
+        auto then(Func fn, reject_fn_t err) -> typename promise<typename detail::then_result<T, decltype(fn(std::declval<T&>()))>::type>::ptr {
+            return chain(std::move(fn), std::move(err));
+        }
+        /**
+         * Like then(fn), but fn is posted to ex once the promise is settled.
+         * The settling thread only posts the continuation, so its cost does not depend on fn.
+         */
+        template<typename Func>
+        auto then_on(const executor_t& ex, Func fn) -> typename promise<typename detail::then_result<T, decltype(fn(std::declval<T&>()))>::type>::ptr {
+            return chain(std::move(fn), reject_fn_t(), ex);
+        }
+        template<typename Func>
+        auto then_on(const executor_t& ex, Func fn, reject_fn_t err) -> typename promise<typename detail::then_result<T, decltype(fn(std::declval<T&>()))>::type>::ptr {
+            return chain(std::move(fn), std::move(err), ex);
         }
         void error(reject_fn_t err) {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state == state::pending) {
-                m_reject_list.push_back(err);
-            } else if(m_state == state::rejected) {
-                err(m_error);
-            }
+            add_continuation([err](promise& p) {
+                if (p.m_state.load(std::memory_order_acquire) == state::rejected) {
+                    try {
+                        err(p.m_error);
+                    } catch(...) {}
+                }
+            });
         }
         state get_state() const {
-            std::unique_lock<std::mutex> lck(m_lck);
-            return m_state;
+            return m_state.load(std::memory_order_acquire);
         }
 
         void wait() {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state == state::pending) {
-                m_cv.wait(lck);
-            }
+            if (spin_wait())
+                return;
+            std::unique_lock<std::mutex> lck(m_wait_mtx);
+            m_waiters++;
+            m_cv.wait(lck, [this]() { return is_done(); });
+            m_waiters--;
         }
         template<typename Rep, typename Period>
         void wait_for(const std::chrono::duration<Rep, Period>& timeout) {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state == state::pending) {
-                m_cv.wait_for(lck, timeout);
-            }
+            wait_util(std::chrono::steady_clock::now() + timeout);
         }
         template<typename Clock, typename Duration>
         void wait_util(const std::chrono::time_point<Clock, Duration>& time) {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state == state::pending) {
-                m_cv.wait_until(lck, time);
-            }
+            if (spin_wait())
+                return;
+            std::unique_lock<std::mutex> lck(m_wait_mtx);
+            m_waiters++;
+            m_cv.wait_until(lck, time, [this]() { return is_done(); });
+            m_waiters--;
         }
         T& get() {
             this->wait();
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state == state::rejected)
+            const auto s = m_state.load(std::memory_order_acquire);
+            if(s == state::rejected)
                 std::rethrow_exception(m_error);
-            else if(m_state == state::resolved)
+            else if(s == state::resolved)
                 return m_value.value();
             else throw std::logic_error("internal error: promise pending after wait");
         }
         std::exception_ptr get_error() {
             this->wait();
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state != state::rejected)
+            if(m_state.load(std::memory_order_acquire) != state::rejected)
                 throw std::logic_error("invalid state");
             return m_error;
         }
 
         static ptr reject(std::exception_ptr err) {
             auto res = std::shared_ptr<promise>(new promise());
-            res->m_state = state::rejected;
-            res->m_error = err;
+            res->try_reject(std::move(err));
             return res;
         }
         static ptr resolve(T&& val) {
             auto res = std::shared_ptr<promise>(new promise());
-            res->m_state = state::resolved;
-            res->m_value.emplace(val);
+            res->try_resolve(std::move(val));
             return res;
         }
 
         static ptr race(std::vector<ptr> l) {
             auto res = std::shared_ptr<promise>(new promise());
             for(auto& e : l) {
-                e->then([res](T val){
-                    if(res->get_state() == state::pending) {
-                        res->do_resolve(std::move(val));
-                    }
-                }, [res](std::exception_ptr err){
-                    if(res->get_state() == state::pending) {
-                        res->do_reject(std::move(err));
-                    }
+                e->add_continuation([res](promise& p) {
+                    if (p.m_state.load(std::memory_order_acquire) == state::resolved)
+                        res->try_resolve(T(p.m_value.value()));
+                    else
+                        res->try_reject(p.m_error);
                 });
             }
             return res;
         }
+        /**
+         * Resolves with the values of all promises in l (in the same order) or rejects with the first error.
+         * Every child settles in O(1): values are stored in preallocated slots and an atomic counter tracks the remaining ones.
+         */
         static std::shared_ptr<promise<std::vector<T>>> all(std::vector<ptr> l) {
             struct all_promise : promise<std::vector<T>> {
-                std::vector<typename promise<T>::ptr> m_children;
+                std::vector<optional<T>> m_slots;
+                std::atomic<size_t> m_remaining;
+                explicit all_promise(size_t n) : m_slots(n), m_remaining(n) {}
             };
-            auto res = std::shared_ptr<all_promise>(new all_promise());
-            res->m_children = std::move(l);
-            for(auto& e : res->m_children) {
-                auto x = e.get();
-                e->then([res, x](T){
-                    if(res->get_state() == state::pending) {
-                        bool ok = true;
-                        for(auto& e2 : res->m_children) {
-                            if(e2.get() == x) continue;
-                            std::unique_lock<std::mutex> lck(e2->m_lck);
-                            if(e2->m_state != state::resolved) {
-                                ok = false;
-                                break;
-                            }
-                        }
-                        if(ok) {
-                            std::vector<T> mvect;
-                            for(auto& e2 : res->m_children) mvect.push_back(e2->m_value.value());
-                            res->do_resolve(std::move(mvect));
-                        }
+            auto res = std::shared_ptr<all_promise>(new all_promise(l.size()));
+            if (l.empty())
+                res->try_resolve(std::vector<T>());
+            for(size_t i = 0; i < l.size(); i++) {
+                l[i]->add_continuation([res, i](promise& p){
+                    if (p.m_state.load(std::memory_order_acquire) == state::rejected) {
+                        res->try_reject(p.m_error);
+                        return;
                     }
-                }, [res](std::exception_ptr err){
-                    if(res->get_state() == state::pending) {
-                        res->do_reject(std::move(err));
+                    res->m_slots[i].emplace(p.m_value.value());
+                    if (res->m_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                        return;
+                    std::vector<T> mvect;
+                    mvect.reserve(res->m_slots.size());
+                    for(auto& e : res->m_slots) mvect.push_back(std::move(e.value()));
+                    res->m_slots.clear();
+                    res->try_resolve(std::move(mvect));
+                });
+            }
+            return res;
+        }
+        // Resolves once all promises in l are settled, never rejects
+        static std::shared_ptr<promise<std::vector<settled_result<T>>>> all_settled(std::vector<ptr> l) {
+            struct all_settled_promise : promise<std::vector<settled_result<T>>> {
+                std::vector<settled_result<T>> m_results;
+                std::atomic<size_t> m_remaining;
+                explicit all_settled_promise(size_t n) : m_results(n), m_remaining(n) {}
+            };
+            auto res = std::shared_ptr<all_settled_promise>(new all_settled_promise(l.size()));
+            if (l.empty())
+                res->try_resolve(std::vector<settled_result<T>>());
+            for(size_t i = 0; i < l.size(); i++) {
+                l[i]->add_continuation([res, i](promise& p){
+                    auto& r = res->m_results[i];
+                    r.status = p.m_state.load(std::memory_order_acquire);
+                    if (r.status == state::resolved)
+                        r.value.emplace(p.m_value.value());
+                    else
+                        r.error = p.m_error;
+                    if (res->m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        res->try_resolve(std::move(res->m_results));
+                });
+            }
+            return res;
+        }
+        // Resolves with the first resolved value, rejects with an aggregate_error once all promises in l are rejected
+        static ptr any(std::vector<ptr> l) {
+            struct any_promise : promise {
+                std::vector<std::exception_ptr> m_errors;
+                std::atomic<size_t> m_remaining;
+                explicit any_promise(size_t n) : m_errors(n), m_remaining(n) {}
+            };
+            auto res = std::shared_ptr<any_promise>(new any_promise(l.size()));
+            if (l.empty())
+                res->try_reject(std::make_exception_ptr(aggregate_error({})));
+            for(size_t i = 0; i < l.size(); i++) {
+                l[i]->add_continuation([res, i](promise& p){
+                    if (p.m_state.load(std::memory_order_acquire) == state::resolved) {
+                        res->try_resolve(T(p.m_value.value()));
+                        return;
                     }
+                    res->m_errors[i] = p.m_error;
+                    if (res->m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        res->try_reject(std::make_exception_ptr(aggregate_error(std::move(res->m_errors))));
                 });
             }
             return res;
         }
+#ifdef TTL_HAS_COROUTINES
+        // Result of co_await on a promise::ptr or task, yields a copy of the value or rethrows the error
+        class awaiter {
+            ptr m_promise;
+        public:
+            explicit awaiter(ptr p)
+                : m_promise(std::move(p))
+            {}
+
+            bool await_ready() const noexcept {
+                return m_promise->get_state() != state::pending;
+            }
+            bool await_suspend(std::coroutine_handle<> h) {
+                void* expected = nullptr;
+                if (m_promise->m_awaiter.compare_exchange_strong(expected, h.address(), std::memory_order_acq_rel))
+                    return true;
+                if (expected == static_cast<void*>(closed()))
+                    return false;
+                // Another coroutine already waits in the fast path
+                std::unique_ptr<continuation> c(new continuation{ [h](promise&) { h.resume(); }, nullptr });
+                if (!m_promise->push_continuation(c.get()))
+                    return false;
+                c.release();
+                return true;
+            }
+            T await_resume() {
+                if (m_promise->get_state() == state::rejected)
+                    std::rethrow_exception(m_promise->m_error);
+                return m_promise->m_value.value();
+            }
+        };
+#endif
     protected:
-        mutable std::mutex m_lck;
-        std::condition_variable m_cv;
-        state m_state = state::pending;
+        // Registered callback, continuations form a lock free stack until the promise is settled
+        struct continuation {
+            std::function<void(promise&)> fn;
+            continuation* next;
+        };
+
+        // Written once before m_state leaves pending, only read afterwards
         optional<T> m_value;
         std::exception_ptr m_error;
-        std::vector<resolve_fn_t> m_resolve_list;
-        std::vector<reject_fn_t> m_reject_list;
+        std::atomic<state> m_state;
+        // Set by the thread settling the promise
+        std::atomic<bool> m_claimed;
+        std::atomic<continuation*> m_continuations;
+        // Only used by threads blocking in wait()
+        std::atomic<size_t> m_waiters;
+        std::mutex m_wait_mtx;
+        std::condition_variable m_cv;
+#ifdef TTL_HAS_COROUTINES
+        // Fast path for a single awaiting coroutine, resumed without allocating a continuation
+        std::atomic<void*> m_awaiter{ nullptr };
+        // Set for promises of a task, the awaiting coroutine is resumed by symmetric transfer from final_suspend
+        bool m_defer_awaiter = false;
 
-        void do_resolve(T&& val) {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state != state::pending)
-                throw std::logic_error("promise is not pending");
-            m_state = state::resolved;
-            m_value.emplace(val);
-            for(auto& e : m_resolve_list) {
+        std::coroutine_handle<> take_awaiter() {
+            auto a = m_awaiter.exchange(static_cast<void*>(closed()), std::memory_order_acq_rel);
+            if (a == nullptr || a == static_cast<void*>(closed()))
+                return nullptr;
+            return std::coroutine_handle<>::from_address(a);
+        }
+#endif
+
+        // Marks the continuation stack as closed, callbacks added afterwards run immediately
+        static continuation* closed() {
+            static continuation c;
+            return &c;
+        }
+
+        bool is_done() const {
+            return m_state.load() != state::pending;
+        }
+
+        // Settled promises are usually picked up quickly, so spin a little before parking the thread
+        bool spin_wait() const {
+            for (int i = 0; i < 128; i++) {
+                if (m_state.load(std::memory_order_acquire) != state::pending)
+                    return true;
+                if (i >= 64)
+                    std::this_thread::yield();
+            }
+            return false;
+        }
+
+        // Returns false if the promise is already settled, c is not added in this case
+        bool push_continuation(continuation* c) {
+            auto head = m_continuations.load(std::memory_order_acquire);
+            do {
+                if (head == closed())
+                    return false;
+                c->next = head;
+            } while (!m_continuations.compare_exchange_weak(head, c, std::memory_order_acq_rel, std::memory_order_acquire));
+            return true;
+        }
+
+        void add_continuation(std::function<void(promise&)> fn) {
+            auto c = new continuation{ std::move(fn), nullptr };
+            if (!push_continuation(c)) {
+                std::unique_ptr<continuation> guard(c);
+                c->fn(*this);
+            }
+        }
+
+        static void run(const ptr& res, const executor_fn_t& fn) {
+            try {
+                fn([res](T val){
+                    res->do_resolve(std::move(val));
+                }, [res](std::exception_ptr err){
+                    res->do_reject(std::move(err));
+                });
+            } catch(...) {
+                res->try_reject(std::current_exception());
+            }
+        }
+
+        template<typename Func>
+        auto chain(Func fn, reject_fn_t err, executor_t ex = executor_t()) -> typename promise<typename detail::then_result<T, decltype(fn(std::declval<T&>()))>::type>::ptr {
+            typedef decltype(fn(std::declval<T&>())) result_type;
+            typedef typename detail::then_result<T, result_type>::type value_type;
+            auto res = std::shared_ptr<promise<value_type>>(new promise<value_type>());
+            std::function<void(promise&)> cont = [res, fn, err](promise& p) mutable {
+                if (p.m_state.load(std::memory_order_acquire) == state::resolved) {
+                    try {
+                        invoke_then(fn, p.m_value.value(), res, static_cast<result_type*>(nullptr));
+                    } catch(...) {
+                        res->try_reject(std::current_exception());
+                    }
+                } else {
+                    if (err) {
+                        try {
+                            err(p.m_error);
+                        } catch(...) {}
+                    }
+                    res->try_reject(p.m_error);
+                }
+            };
+            if (ex) {
+                add_continuation([ex, cont, res](promise& p) {
+                    auto self = p.shared_from_this();
+                    try {
+                        ex([self, cont]() mutable { cont(*self); });
+                    } catch(...) {
+                        res->try_reject(std::current_exception());
+                    }
+                });
+            } else {
+                add_continuation(std::move(cont));
+            }
+            return res;
+        }
+
+        template<typename Func>
+        static void invoke_then(Func& fn, T& val, const ptr& res, void*) {
+            fn(val);
+            res->try_resolve(T(val));
+        }
+        template<typename Func, typename U>
+        static void invoke_then(Func& fn, T& val, const std::shared_ptr<promise<U>>& res, std::shared_ptr<promise<U>>*) {
+            auto inner = fn(val);
+            if (!inner)
+                throw std::logic_error("continuation returned no promise");
+            inner->add_continuation([res](promise<U>& p) {
+                if (p.m_state.load(std::memory_order_acquire) == state::resolved)
+                    res->try_resolve(U(p.m_value.value()));
+                else
+                    res->try_reject(p.m_error);
+            });
+        }
+        template<typename Func, typename U, typename R>
+        static void invoke_then(Func& fn, T& val, const std::shared_ptr<promise<U>>& res, R*) {
+            res->try_resolve(fn(val));
+        }
+
+        // Run all registered continuations in registration order and close the stack
+        void complete() {
+            auto c = m_continuations.exchange(closed(), std::memory_order_acq_rel);
+            continuation* list = nullptr;
+            while (c != nullptr && c != closed()) {
+                auto next = c->next;
+                c->next = list;
+                list = c;
+                c = next;
+            }
+            while (list != nullptr) {
+                std::unique_ptr<continuation> cur(list);
+                list = list->next;
                 try {
-                    e(m_value.value());
-                } catch(const std::exception&) {}
+                    cur->fn(*this);
+                } catch(...) {}
             }
-            m_resolve_list.clear();
-            m_reject_list.clear();
-            m_cv.notify_all();
+            if (m_waiters.load() != 0) {
+                std::unique_lock<std::mutex> lck(m_wait_mtx);
+                m_cv.notify_all();
+            }
+#ifdef TTL_HAS_COROUTINES
+            if (!m_defer_awaiter) {
+                auto a = take_awaiter();
+                if (a)
+                    a.resume();
+            }
+#endif
+        }
+
+        // Settle the promise if it is still pending, returns false if it was already settled
+        bool try_resolve(T&& val) {
+            if (m_claimed.exchange(true, std::memory_order_acq_rel))
+                return false;
+            m_value.emplace(std::move(val));
+            m_state.store(state::resolved);
+            complete();
+            return true;
+        }
+        bool try_reject(std::exception_ptr val) {
+            if (m_claimed.exchange(true, std::memory_order_acq_rel))
+                return false;
+            m_error = std::move(val);
+            m_state.store(state::rejected);
+            complete();
+            return true;
+        }
+
+        void do_resolve(T&& val) {
+            if(!try_resolve(std::move(val)))
+                throw std::logic_error("promise is not pending");
         }
         void do_reject(std::exception_ptr val) {
-            std::unique_lock<std::mutex> lck(m_lck);
-            if(m_state != state::pending)
+            if(!try_reject(std::move(val)))
                 throw std::logic_error("promise is not pending");
-            m_state = state::rejected;
-            m_error = val;
-            for(auto& e : m_reject_list) {
-                try {
-                    e(m_error);
-                } catch(const std::exception&) {}
+        }
+    };
+
+#ifdef TTL_HAS_COROUTINES
+    template<typename T>
+    typename promise<T>::awaiter operator co_await(const std::shared_ptr<promise<T>>& p) {
+        return typename promise<T>::awaiter(p);
+    }
+
+    /**
+     * Coroutine return type backed by a promise<T>. The coroutine starts running immediately,
+     * co_return resolves and an escaping exception rejects the promise.
+     * A single coroutine awaiting the task is resumed by symmetric transfer without allocating a continuation.
+     */
+    template<typename T>
+    class task {
+        typename promise<T>::ptr m_promise;
+
+        explicit task(typename promise<T>::ptr p)
+            : m_promise(std::move(p))
+        {}
+    public:
+        class promise_type {
+            typename promise<T>::ptr m_result;
+
+            struct final_awaiter {
+                typename promise<T>::ptr result;
+
+                bool await_ready() const noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+                    // The awaiter lives in the frame, so take the promise before destroying it
+                    auto res = std::move(result);
+                    h.destroy();
+                    auto next = res->take_awaiter();
+                    if (next)
+                        return next;
+                    return std::noop_coroutine();
+                }
+                void await_resume() const noexcept {}
+            };
+        public:
+            promise_type()
+                : m_result(new promise<T>())
+            {
+                m_result->m_defer_awaiter = true;
             }
-            m_resolve_list.clear();
-            m_reject_list.clear();
-            m_cv.notify_all();
+
+            task get_return_object() { return task(m_result); }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            final_awaiter final_suspend() noexcept { return final_awaiter{ m_result }; }
+            template<typename U>
+            void return_value(U&& val) { m_result->try_resolve(T(std::forward<U>(val))); }
+            void unhandled_exception() { m_result->try_reject(std::current_exception()); }
+        };
+
+        const typename promise<T>::ptr& get_promise() const { return m_promise; }
+        operator typename promise<T>::ptr() const { return m_promise; }
+
+        typename promise<T>::awaiter operator co_await() const {
+            return typename promise<T>::awaiter(m_promise);
         }
     };
+#endif
 }
@@ -1,45 +1,491 @@
 #pragma once
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <unordered_map>
+#include <condition_variable>
+#include <new>
+#include <chrono>
 
 namespace ttl {
+	namespace detail {
+		// Polling delay for waits that might take long: yields a few times, then sleeps up to 1ms between polls
+		class backoff {
+			unsigned m_attempt = 0;
+		public:
+			void wait() {
+				if (m_attempt < 16) {
+					std::this_thread::yield();
+					m_attempt++;
+					return;
+				}
+				const auto shift = m_attempt - 16;
+				std::this_thread::sleep_for(std::chrono::microseconds(1u << shift));
+				if (shift < 10)
+					m_attempt++;
+			}
+		};
+	}
+
+	/**
+	 * Epoch based tracking of rcu readers shared by all rcu instances.
+	 * Every thread gets a reader record once, entering a read side critical section only stores the
+	 * current epoch into this thread local record, so readers never write to shared cache lines.
+	 * Writers wait for a grace period (synchronize()) until every reader that might still see old data has left.
+	 * call_rcu() defers this wait and the reclamation of old data to a background thread.
+	 */
+	class rcu_domain {
+		// Every record fills its own cache line, so readers never share a line with another thread
+		struct alignas(64) reader {
+			// Epoch the reader entered its critical section in, 0 if not inside one
+			std::atomic<uint64_t> epoch;
+			// Only accessed by the owning thread
+			size_t nesting;
+			std::atomic<bool> in_use;
+			reader* next;
+			// Allocation the record was placed in
+			void* raw;
+
+			reader()
+				: epoch(0), nesting(0), in_use(true), next(nullptr), raw(nullptr)
+			{}
+		};
+
+		// operator new only guarantees alignof(std::max_align_t) before C++17
+		static reader* create_reader() {
+			void* raw = ::operator new(sizeof(reader) + alignof(reader));
+			const auto addr = (reinterpret_cast<uintptr_t>(raw) + alignof(reader) - 1) & ~static_cast<uintptr_t>(alignof(reader) - 1);
+			auto r = new (reinterpret_cast<void*>(addr)) reader();
+			r->raw = raw;
+			return r;
+		}
+
+		static void destroy_reader(reader* r) {
+			void* raw = r->raw;
+			r->~reader();
+			::operator delete(raw);
+		}
+
+		std::atomic<reader*> m_readers;
+		std::atomic<uint64_t> m_epoch;
+
+		// Callbacks waiting for a grace period, run by the reclaimer thread
+		std::mutex m_mtx;
+		std::condition_variable m_cv;
+		std::condition_variable m_done_cv;
+		std::vector<std::function<void()>> m_callbacks;
+		uint64_t m_queued;
+		uint64_t m_completed;
+		bool m_exit;
+		std::thread m_thread;
+
+		rcu_domain()
+			: m_readers(nullptr), m_epoch(1), m_queued(0), m_completed(0), m_exit(false)
+		{}
+
+		~rcu_domain() {
+			{
+				std::unique_lock<std::mutex> lck(m_mtx);
+				m_exit = true;
+				m_cv.notify_all();
+			}
+			if (m_thread.joinable())
+				m_thread.join();
+			auto r = m_readers.load();
+			while (r) {
+				auto next = r->next;
+				destroy_reader(r);
+				r = next;
+			}
+		}
+
+		reader* acquire_reader() {
+			// Reuse the record of a finished thread
+			for (auto r = m_readers.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+				bool expected = false;
+				if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true))
+					return r;
+			}
+			auto r = create_reader();
+			auto head = m_readers.load(std::memory_order_relaxed);
+			do {
+				r->next = head;
+			} while (!m_readers.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+			return r;
+		}
+
+		reader& local_reader() {
+			struct handle {
+				reader* r;
+				~handle() {
+					if (r) r->in_use.store(false, std::memory_order_release);
+				}
+			};
+			static thread_local handle h = { nullptr };
+			if (h.r == nullptr)
+				h.r = acquire_reader();
+			return *h.r;
+		}
+
+		static bool& reclaimer_flag() {
+			static thread_local bool flag = false;
+			return flag;
+		}
+
+		void reclaim_fn() {
+			reclaimer_flag() = true;
+			std::unique_lock<std::mutex> lck(m_mtx);
+			while (true) {
+				m_cv.wait(lck, [this]() { return m_exit || !m_callbacks.empty(); });
+				// Pending callbacks are still run on exit
+				if (m_callbacks.empty())
+					break;
+				std::vector<std::function<void()>> batch;
+				batch.swap(m_callbacks);
+				lck.unlock();
+				// One grace period for all callbacks queued so far
+				synchronize();
+				for (auto& fn : batch) {
+					try {
+						fn();
+					} catch (...) {}
+				}
+				const auto n = batch.size();
+				batch.clear();
+				lck.lock();
+				m_completed += n;
+				m_done_cv.notify_all();
+			}
+		}
+	public:
+		static rcu_domain& instance() {
+			static rcu_domain domain;
+			return domain;
+		}
+
+		// Enter a read side critical section, can be nested
+		void read_lock() {
+			auto& r = local_reader();
+			// The epoch needs to be visible before any protected pointer is read (which uses seq_cst as well)
+			if (r.nesting++ == 0)
+				r.epoch.store(m_epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+		}
+
+		void read_unlock() {
+			auto& r = local_reader();
+			if (--r.nesting == 0)
+				r.epoch.store(0, std::memory_order_release);
+		}
+
+		/**
+		 * Wait until all read side critical sections that started before this call are finished.
+		 * Must not be called while the calling thread holds a read lock.
+		 */
+		void synchronize() {
+			const auto target = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+			for (auto r = m_readers.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+				// Do not burn a core while a reader stays inside its critical section for a long time
+				detail::backoff delay;
+				while (true) {
+					const auto e = r->epoch.load(std::memory_order_seq_cst);
+					if (e == 0 || e >= target)
+						break;
+					delay.wait();
+				}
+			}
+		}
+
+		/**
+		 * Run fn on the background reclaimer thread after all read side critical sections that
+		 * started before this call are finished. Does not block, so old data can be freed off the hot path.
+		 * Exceptions thrown by fn are ignored.
+		 */
+		void call_rcu(std::function<void()> fn) {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			if (!m_thread.joinable())
+				m_thread = std::thread(&rcu_domain::reclaim_fn, this);
+			m_callbacks.push_back(std::move(fn));
+			m_queued++;
+			m_cv.notify_all();
+		}
+
+		// Wait until all callbacks queued by call_rcu() before this call have run, must not be called from a callback
+		void barrier() {
+			std::unique_lock<std::mutex> lck(m_mtx);
+			const auto target = m_queued;
+			m_done_cv.wait(lck, [&]() { return m_completed >= target; });
+		}
+
+		// True if called from a callback passed to call_rcu()
+		static bool in_reclaimer() {
+			return reclaimer_flag();
+		}
+	};
+
 	// A type to allow for easy rcu (read,copy,update)
 	template<typename T>
 	class rcu {
+		// Published version, readers only dereference it inside a read side critical section
+		struct node {
+			std::shared_ptr<const T> data;
+		};
+
+		// Frees versions on the reclaimer thread, even if the last reference was held by a reader calling get()
+		struct deferred_delete {
+			void operator()(const T* ptr) const {
+				if (rcu_domain::in_reclaimer())
+					delete ptr;
+				else
+					rcu_domain::instance().call_rcu([ptr]() { delete ptr; });
+			}
+		};
+
+		template<typename... Args>
+		static std::shared_ptr<T> make_data(Args&&... args) {
+			std::unique_ptr<T> ptr(new T(std::forward<Args>(args)...));
+			std::shared_ptr<T> res(ptr.get(), deferred_delete());
+			ptr.release();
+			return res;
+		}
+
 		// We only need the mutex to prevent concurrent modifications.
 		// We could do atomic exchange but this is intended for low write high read structures
 		// so we just use a mutex because it makes modification a lot easier.
 		std::mutex write_mtx;
-		std::shared_ptr<T> data;
+		std::atomic<node*> current;
+
+		// Mutations queued by enqueue() and update_batched(), applied together in a single copy
+		struct pending_update {
+			std::function<void(T&)> fn;
+			uint64_t ticket;
+			// Set if a writer waits for the result (update_batched)
+			bool wait;
+		};
+		std::mutex queue_mtx;
+		std::vector<pending_update> pending;
+		uint64_t next_ticket = 0;
+		uint64_t published_ticket = 0;
+		std::unordered_map<uint64_t, std::exception_ptr> errors;
+
+		uint64_t push_pending(std::function<void(T&)> fn, bool wait) {
+			std::lock_guard<std::mutex> lck(queue_mtx);
+			const auto ticket = ++next_ticket;
+			pending.push_back({ std::move(fn), ticket, wait });
+			return ticket;
+		}
+
+		/**
+		 * Apply all queued mutations to one copy and publish it, write_mtx needs to be locked.
+		 * If the copy fails, waiting writers get the exception, queued mutations stay queued and it is rethrown.
+		 */
+		void apply_pending() {
+			std::vector<pending_update> batch;
+			{
+				std::lock_guard<std::mutex> lck(queue_mtx);
+				batch.swap(pending);
+			}
+			if (batch.empty())
+				return;
+			const auto last = batch.back().ticket;
+			std::vector<std::pair<uint64_t, std::exception_ptr>> failed;
+			while (!batch.empty()) {
+				std::shared_ptr<T> mdata;
+				try {
+					mdata = make_data(*current.load(std::memory_order_acquire)->data);
+				} catch (...) {
+					fail_batch(batch, failed, last, std::current_exception());
+					throw;
+				}
+				bool restart = false;
+				for (size_t i = 0; i < batch.size(); i++) {
+					try {
+						batch[i].fn(*mdata);
+					} catch (...) {
+						// The copy might be partially modified, so start over without the failed mutation
+						if (batch[i].wait)
+							failed.emplace_back(batch[i].ticket, std::current_exception());
+						batch.erase(batch.begin() + static_cast<std::ptrdiff_t>(i));
+						restart = true;
+						break;
+					}
+				}
+				if (!restart) {
+					publish(std::move(mdata));
+					break;
+				}
+			}
+			std::lock_guard<std::mutex> lck(queue_mtx);
+			published_ticket = last;
+			for (auto& e : failed)
+				errors[e.first] = e.second;
+		}
+
+		// Report error to all waiting writers of batch and put the other mutations back into the queue
+		void fail_batch(std::vector<pending_update>& batch, std::vector<std::pair<uint64_t, std::exception_ptr>>& failed, uint64_t last, std::exception_ptr error) {
+			std::lock_guard<std::mutex> lck(queue_mtx);
+			std::vector<pending_update> requeue;
+			for (auto& e : batch) {
+				if (e.wait)
+					errors[e.ticket] = error;
+				else
+					requeue.push_back(std::move(e));
+			}
+			requeue.insert(requeue.end(), std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+			pending.swap(requeue);
+			published_ticket = last;
+			for (auto& e : failed)
+				errors[e.first] = e.second;
+		}
+
+		void publish(std::shared_ptr<const T> data) {
+			auto old = current.exchange(new node{ std::move(data) }, std::memory_order_seq_cst);
+			// Readers might still use the old version, free it after a grace period on the reclaimer thread.
+			// get() copies keep their data alive.
+			rcu_domain::instance().call_rcu([old]() { delete old; });
+		}
 	public:
+		/**
+		 * Access to the current data without any reference counting.
+		 * The data stays valid until the guard is destroyed, old versions are only freed once all guards reading them are gone.
+		 * Do not keep guards for a long time, this delays the reclamation of all old versions.
+		 */
+		class read_guard {
+			const T* data;
+		public:
+			explicit read_guard(const rcu& r)
+				: data(nullptr)
+			{
+				rcu_domain::instance().read_lock();
+				data = r.current.load(std::memory_order_seq_cst)->data.get();
+			}
+			read_guard(read_guard&& other) noexcept
+				: data(other.data)
+			{
+				other.data = nullptr;
+			}
+			read_guard(const read_guard&) = delete;
+			read_guard& operator=(const read_guard&) = delete;
+			read_guard& operator=(read_guard&&) = delete;
+			~read_guard() {
+				if (data)
+					rcu_domain::instance().read_unlock();
+			}
+
+			const T& operator*() const { return *data; }
+			const T* operator->() const { return data; }
+			const T* get() const { return data; }
+		};
+
+		// Touch the domain first, so it outlives static rcu instances
 		rcu()
-			: data(std::make_shared<T>())
+			: current((rcu_domain::instance(), new node{ make_data() }))
 		{}
 
 		template<typename... Args>
 		explicit rcu(Args&&... args)
-			: data(std::make_shared<T>(std::forward<Args>(args)...))
+			: current((rcu_domain::instance(), new node{ make_data(std::forward<Args>(args)...) }))
 		{}
 
+		rcu(const rcu&) = delete;
+		rcu& operator=(const rcu&) = delete;
+
+		// Old versions might still be pending on the reclaimer thread, use rcu_domain::barrier() to wait for them
+		~rcu() {
+			delete current.load();
+		}
+
 		// Threadsafe update of data
 		template<typename Func>
 		void update(Func f)
 		{
 			std::lock_guard<std::mutex> lck(write_mtx);
-			// Get local pointer
-			std::shared_ptr<const T> pdata = std::atomic_load(&data);
 			// Copy it
-			auto mdata = std::make_shared<T>(*pdata);
+			auto mdata = make_data(*current.load(std::memory_order_acquire)->data);
 			f(*mdata);
 			// Copy to class instance
-			std::atomic_store(&data, mdata);
+			publish(std::move(mdata));
+		}
+
+		/**
+		 * Replace the data by a new version built from the current one, without copying it first.
+		 * Use this with persistent (structurally shared) containers, where f can return a modified
+		 * version in O(log n) that shares most of its memory with the current one.
+		 */
+		template<typename Func>
+		void replace(Func f)
+		{
+			std::lock_guard<std::mutex> lck(write_mtx);
+			const auto& cur = *current.load(std::memory_order_acquire)->data;
+			publish(make_data(f(cur)));
+		}
+
+		/**
+		 * Like update(), but mutations of concurrent writers are combined into a single copy and publish.
+		 * Returns after the mutation is visible to readers, exceptions thrown by fn are rethrown
+		 * and do not affect the mutations of other writers.
+		 */
+		void update_batched(std::function<void(T&)> fn)
+		{
+			const auto ticket = push_pending(std::move(fn), true);
+			{
+				std::lock_guard<std::mutex> lck(write_mtx);
+				bool done;
+				{
+					std::lock_guard<std::mutex> qlck(queue_mtx);
+					done = published_ticket >= ticket;
+				}
+				// Another writer might have published our mutation while we waited for the lock.
+				// If the copy fails the error is recorded for our ticket as well.
+				if (!done) {
+					try {
+						apply_pending();
+					} catch (...) {}
+				}
+			}
+			std::exception_ptr error;
+			{
+				std::lock_guard<std::mutex> lck(queue_mtx);
+				auto it = errors.find(ticket);
+				if (it != errors.end()) {
+					error = it->second;
+					errors.erase(it);
+				}
+			}
+			if (error)
+				std::rethrow_exception(error);
+		}
+
+		// Queue a mutation without publishing it, the next commit() or update_batched() applies it
+		void enqueue(std::function<void(T&)> fn)
+		{
+			push_pending(std::move(fn), false);
+		}
+
+		// Apply all queued mutations in one copy and publish cycle
+		void commit()
+		{
+			std::lock_guard<std::mutex> lck(write_mtx);
+			apply_pending();
 		}
 
 		// Get the current data
 		// The returned data will not change during its lifetime.
 		// To get updates you need to call get() again
 		std::shared_ptr<const T> get() const {
-			return std::atomic_load(&data);
+			rcu_domain::instance().read_lock();
+			auto res = current.load(std::memory_order_seq_cst)->data;
+			rcu_domain::instance().read_unlock();
+			return res;
+		}
+
+		// Get the current data without touching any shared reference count
+		read_guard read_lock() const {
+			return read_guard(*this);
 		}
 	};
 }
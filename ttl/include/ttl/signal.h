@@ -2,63 +2,242 @@
 #include <memory>
 #include "noncopyable.h"
 #include <mutex>
-#include <set>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "rcu.h"
 
 namespace ttl {
 	template<typename MutexType, typename... Args>
 	class signal_base {
+		/**
+		 * Delegates are kept in a copy on write array. Emitting only counts itself as running and loads the array
+		 * pointer, adding or removing a delegate copies the array under the mutex. Replaced arrays are freed once
+		 * no emission that might use them is running.
+		 * Releasing a token waits until running calls of its handler returned, so the handler is never entered afterwards.
+		 * The wait is skipped if the token is released from a handler of the same signal, as it might wait for itself.
+		 */
 		class signal_data : public std::enable_shared_from_this<signal_data>, public noncopyable {
 		private:
+			// Handler of one connection, stored once and referenced by every delegate array containing it
 			class delegate_base {
-				std::shared_ptr<signal_data> _signal;
 			public:
-				explicit delegate_base(std::shared_ptr<signal_data> sig)
-					:_signal(sig)
-				{
-					_signal->add(this);
-				}
-				virtual ~delegate_base() {
-					_signal->remove(this);
-					_signal.reset();
-				}
+				std::atomic<bool> disconnected;
+
+				delegate_base() : disconnected(false) {}
+				virtual ~delegate_base() {}
 				virtual void invoke(Args... args) = 0;
 			};
 			template<typename Func>
 			class delegate : public delegate_base {
 				Func func;
 			public:
-				delegate(Func f, std::shared_ptr<signal_data> evt)
-					: delegate_base(evt), func(f)
+				explicit delegate(Func f)
+					: func(std::move(f))
 				{}
-				virtual void invoke(Args... args) override {
+				void invoke(Args... args) override {
 					func(std::forward<Args>(args)...);
 				}
 			};
+			// Owned by the token, removes the delegate once the token is released
+			class connection {
+				std::shared_ptr<signal_data> _signal;
+				std::unique_ptr<delegate_base> _delegate;
+			public:
+				connection(std::shared_ptr<signal_data> sig, std::unique_ptr<delegate_base> del)
+					: _signal(std::move(sig)), _delegate(std::move(del))
+				{}
+				~connection() {
+					_signal->remove(std::move(_delegate));
+				}
+			};
+			// Only pointers, so copying the array on updates never copies handlers
+			typedef std::vector<delegate_base*> delegate_list;
+			// Replaced arrays and removed delegates running emissions might still use
+			struct retired_data {
+				std::vector<std::unique_ptr<const delegate_list>> lists;
+				std::vector<std::unique_ptr<delegate_base>> delegates;
+
+				bool empty() const { return lists.empty() && delegates.empty(); }
+				void append(retired_data&& other) {
+					for (auto& l : other.lists)
+						lists.push_back(std::move(l));
+					for (auto& d : other.delegates)
+						delegates.push_back(std::move(d));
+				}
+			};
+			// Counts an emission as running until it left, also if a handler throws
+			struct running_ref {
+				std::atomic<size_t>& running;
+				~running_ref() { running.fetch_sub(1, std::memory_order_seq_cst); }
+			};
+			// Emissions running on this thread
+			struct emission {
+				const signal_data* sig;
+				emission* prev;
+
+				explicit emission(const signal_data* s)
+					: sig(s), prev(top())
+				{
+					top() = this;
+				}
+				~emission() {
+					top() = prev;
+				}
+				static emission*& top() {
+					static thread_local emission* e = nullptr;
+					return e;
+				}
+			};
+			// Replaced arrays kept until no emission uses them, beyond this add() waits for running emissions
+			static constexpr size_t max_retired = 16;
 
 			MutexType mutex;
-			std::set<delegate_base*> delegates;
+			std::atomic<const delegate_list*> delegates;
+			retired_data retired;
+			std::atomic<bool> has_retired;
+			/**
+			 * Running emissions, counted in the slot of the phase they started in.
+			 * Waiting flips the phase, so new emissions use the other slot and the old one drains.
+			 */
+			std::atomic<size_t> running[2];
+			std::atomic<size_t> phase;
+			// Serializes waits, so two waiters do not flip the phase under each other
+			MutexType wait_mutex;
 
-			void add(delegate_base* del) {
-				std::lock_guard<MutexType> lck(mutex);
-				delegates.insert(del);
+			// Needs the mutex to be locked
+			void publish(const delegate_list* list) {
+				retired.lists.emplace_back(delegates.exchange(list, std::memory_order_seq_cst));
+				has_retired.store(true, std::memory_order_relaxed);
 			}
-			void remove(delegate_base* del) {
+			// Needs the mutex to be locked, the result is freed after unlocking as handlers might release tokens when destroyed
+			retired_data take_retired() {
+				retired_data res;
+				std::swap(res, retired);
+				has_retired.store(false, std::memory_order_relaxed);
+				return res;
+			}
+			/**
+			 * Free the replaced arrays and removed delegates if no emission is running. Emissions starting later
+			 * count themselves before loading the array, so they only see the current one.
+			 */
+			void try_reclaim() {
+				retired_data old;
 				std::lock_guard<MutexType> lck(mutex);
-				delegates.erase(del);
+				if (running[0].load(std::memory_order_seq_cst) == 0 && running[1].load(std::memory_order_seq_cst) == 0)
+					old = take_retired();
+			}
+			// Wait until all emissions that might not have seen a disconnected flag or the current array have returned
+			void wait_for_emissions() {
+				std::lock_guard<MutexType> lck(wait_mutex);
+				// An emission might have read the phase before the first flip and count itself afterwards, so drain both slots
+				for (int i = 0; i < 2; i++) {
+					const auto idx = phase.fetch_add(1, std::memory_order_seq_cst) & 1;
+					detail::backoff delay;
+					while (running[idx].load(std::memory_order_seq_cst) != 0)
+						delay.wait();
+				}
+			}
+			// Free the arrays replaced so far, waits for running emissions unless called from a handler of this signal
+			void reclaim() {
+				retired_data old;
+				{
+					std::lock_guard<MutexType> lck(mutex);
+					old = take_retired();
+				}
+				if (is_emitting()) {
+					std::lock_guard<MutexType> lck(mutex);
+					retired.append(std::move(old));
+					has_retired.store(!retired.empty(), std::memory_order_relaxed);
+					return;
+				}
+				wait_for_emissions();
+			}
+			void add(delegate_base* del) {
+				bool full;
+				{
+					std::lock_guard<MutexType> lck(mutex);
+					const auto cur = delegates.load(std::memory_order_relaxed);
+					std::unique_ptr<delegate_list> list(new delegate_list());
+					list->reserve(cur->size() + 1);
+					for (auto& e : *cur)
+						list->push_back(e);
+					list->push_back(del);
+					publish(list.release());
+					full = retired.lists.size() >= max_retired;
+				}
+				if (full)
+					reclaim();
+				else try_reclaim();
+			}
+			void remove(std::unique_ptr<delegate_base> del) {
+				{
+					std::lock_guard<MutexType> lck(mutex);
+					// Emissions holding the old array skip the delegate from now on
+					del->disconnected.store(true, std::memory_order_seq_cst);
+					const auto cur = delegates.load(std::memory_order_relaxed);
+					std::unique_ptr<delegate_list> list(new delegate_list());
+					list->reserve(cur->size());
+					for (auto e : *cur) {
+						if (e != del.get())
+							list->push_back(e);
+					}
+					publish(list.release());
+					retired.delegates.push_back(std::move(del));
+				}
+				// Also waits until running calls of the handler returned
+				reclaim();
+			}
+			bool is_emitting() const {
+				for (auto e = emission::top(); e != nullptr; e = e->prev) {
+					if (e->sig == this)
+						return true;
+				}
+				return false;
 			}
 		public:
 			typedef std::shared_ptr<void> delegate_ptr;
 
+			signal_data()
+				: delegates(new delegate_list()), has_retired(false), phase(0)
+			{
+				running[0] = 0;
+				running[1] = 0;
+			}
+
+			// No emission can be running, as they keep the signal alive
+			~signal_data() {
+				delete delegates.load();
+			}
+
 			template<typename Func>
 			delegate_ptr add(Func f) {
-				return std::make_shared<delegate<Func>>(f, this->shared_from_this());
+				std::unique_ptr<delegate_base> del(new delegate<Func>(std::move(f)));
+				const auto ptr = del.get();
+				auto res = std::make_shared<connection>(this->shared_from_this(), std::move(del));
+				this->add(ptr);
+				return res;
 			}
 
 			void invoke(Args... args) {
-				std::lock_guard<MutexType> lck(mutex);
-				for (delegate_base* e : delegates) {
-					e->invoke(args...);
+				{
+					// Either a remover waits for this emission, or the emission sees the delegate disconnected
+					auto& slot = running[phase.load(std::memory_order_seq_cst) & 1];
+					slot.fetch_add(1, std::memory_order_seq_cst);
+					running_ref guard{ slot };
+					emission self(this);
+					// Handlers are free to add or remove delegates, added ones are called by later emissions
+					const auto list = delegates.load(std::memory_order_seq_cst);
+					for (auto e : *list) {
+						if (e->disconnected.load(std::memory_order_seq_cst))
+							continue;
+						e->invoke(args...);
+					}
 				}
+				// Arrays replaced by handlers are freed once the last emission returned
+				if (has_retired.load(std::memory_order_relaxed))
+					try_reclaim();
 			}
 		};
 		std::shared_ptr<signal_data> data;
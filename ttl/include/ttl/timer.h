@@ -4,9 +4,12 @@
 #include <condition_variable>
 #include <chrono>
 #include <memory>
-#include <set>
+#include <vector>
+#include <deque>
 #include <atomic>
 #include <functional>
+#include <limits>
+#include <stdexcept>
 
 namespace ttl {
 	class timer {
@@ -15,82 +18,320 @@ namespace ttl {
 		typedef std::function<void()> handler_fn_t;
 
 		typedef std::function<void(std::exception_ptr)> exception_fn_t;
+		// Runs the passed function (e.g. by posting it to a thread pool), needs to run all functions before the timer is destroyed
+		typedef std::function<void(std::function<void()>)> executor_fn_t;
+
+		// Lateness of task executions (time the handler started - scheduled time)
+		struct task_stats {
+			uint64_t executions;
+			std::chrono::nanoseconds last_lateness;
+			std::chrono::nanoseconds min_lateness;
+			std::chrono::nanoseconds max_lateness;
+			std::chrono::nanoseconds total_lateness;
+
+			std::chrono::nanoseconds average_lateness() const {
+				return executions == 0 ? std::chrono::nanoseconds(0) : total_lateness / static_cast<int64_t>(executions);
+			}
+
+			// Spread of the start times around the schedule
+			std::chrono::nanoseconds jitter() const {
+				return max_lateness - min_lateness;
+			}
+		};
+
+		// How a periodic task is rescheduled after it ran
+		enum class periodic_policy {
+			// Next run is one period after the handler started, a slow handler runs again right after it finished
+			fixed_start,
+			// Next run is one period after the handler finished
+			fixed_delay,
+			// Runs are anchored to the first deadline, missed runs are executed back to back
+			catch_up,
+			// Runs are anchored to the first deadline, missed runs are skipped
+			skip
+		};
 
 		class every {
 			friend class timer;
 			std::chrono::nanoseconds dur;
+			periodic_policy policy;
 		public:
 			template<typename T>
-			explicit every(T t)
-				: dur(std::chrono::duration_cast<std::chrono::nanoseconds>(t))
+			explicit every(T t, periodic_policy p = periodic_policy::fixed_start)
+				: dur(std::chrono::duration_cast<std::chrono::nanoseconds>(t)), policy(p)
 			{}
+
+			periodic_policy get_policy() const { return policy; }
 		};
 
 	private:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		class lateness_counter {
+			std::atomic<uint64_t> m_executions{ 0 };
+			std::atomic<int64_t> m_last{ 0 };
+			std::atomic<int64_t> m_min{ std::numeric_limits<int64_t>::max() };
+			std::atomic<int64_t> m_max{ std::numeric_limits<int64_t>::min() };
+			std::atomic<int64_t> m_total{ 0 };
+		public:
+			void record(std::chrono::nanoseconds lateness) {
+				const auto ns = lateness.count();
+				m_last.store(ns, std::memory_order_relaxed);
+				m_total.fetch_add(ns, std::memory_order_relaxed);
+				auto min = m_min.load(std::memory_order_relaxed);
+				while (ns < min && !m_min.compare_exchange_weak(min, ns, std::memory_order_relaxed)) {}
+				auto max = m_max.load(std::memory_order_relaxed);
+				while (ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+				m_executions.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			task_stats get() const {
+				task_stats res;
+				res.executions = m_executions.load(std::memory_order_relaxed);
+				res.last_lateness = std::chrono::nanoseconds(m_last.load(std::memory_order_relaxed));
+				res.min_lateness = std::chrono::nanoseconds(res.executions == 0 ? 0 : m_min.load(std::memory_order_relaxed));
+				res.max_lateness = std::chrono::nanoseconds(res.executions == 0 ? 0 : m_max.load(std::memory_order_relaxed));
+				res.total_lateness = std::chrono::nanoseconds(m_total.load(std::memory_order_relaxed));
+				return res;
+			}
+		};
+
 		struct task_t {
+			// Deadline rounded to the timer resolution, used to order the heap
 			std::chrono::steady_clock::time_point tp;
+			// Requested deadline
+			std::chrono::steady_clock::time_point due;
 			handler_fn_t fn;
+			// Position in m_tasks, npos if the task is not scheduled
+			size_t heap_index = npos;
+			// Zero for one shot tasks
+			std::chrono::nanoseconds period{ 0 };
+			periodic_policy policy = periodic_policy::fixed_start;
+			// Periodic tasks are only rearmed if they were not cleared while running
+			bool cancelled = false;
+			uint64_t generation = 0;
+			lateness_counter stats;
+		};
+		// A task taken from the heap, deadline is kept as periodic tasks reschedule themselves
+		struct ready_task {
+			std::shared_ptr<task_t> task;
+			std::chrono::steady_clock::time_point deadline;
 		};
-		std::set<std::shared_ptr<task_t>> m_tasks;
+		// Binary min heap ordered by deadline, tasks know their index so they can be removed in O(log n)
+		std::vector<std::shared_ptr<task_t>> m_tasks;
+		const std::chrono::nanoseconds m_resolution;
 		mutable std::mutex mtx;
 		std::condition_variable cv;
 		std::thread thread;
 		std::atomic<bool> exit_thread;
 		exception_fn_t exception_handler;
+		executor_fn_t m_executor;
+		lateness_counter m_stats;
+		// Incremented by clear_all(), so running periodic tasks do not rearm
+		uint64_t m_generation = 0;
+
+		// Internal worker pool, only used if no executor is set
+		std::vector<std::thread> m_workers;
+		std::deque<ready_task> m_queue;
+		std::mutex m_queue_mtx;
+		std::condition_variable m_queue_cv;
+		bool m_queue_exit;
+
+		void heap_set(size_t idx, std::shared_ptr<task_t> task) {
+			task->heap_index = idx;
+			m_tasks[idx] = std::move(task);
+		}
+
+		void sift_up(size_t idx) {
+			auto task = std::move(m_tasks[idx]);
+			while (idx > 0) {
+				const auto parent = (idx - 1) / 2;
+				if (!(task->tp < m_tasks[parent]->tp))
+					break;
+				heap_set(idx, std::move(m_tasks[parent]));
+				idx = parent;
+			}
+			heap_set(idx, std::move(task));
+		}
+
+		void sift_down(size_t idx) {
+			auto task = std::move(m_tasks[idx]);
+			const auto size = m_tasks.size();
+			while (true) {
+				auto child = idx * 2 + 1;
+				if (child >= size)
+					break;
+				if (child + 1 < size && m_tasks[child + 1]->tp < m_tasks[child]->tp)
+					child++;
+				if (!(m_tasks[child]->tp < task->tp))
+					break;
+				heap_set(idx, std::move(m_tasks[child]));
+				idx = child;
+			}
+			heap_set(idx, std::move(task));
+		}
+
+		void heap_push(std::shared_ptr<task_t> task) {
+			m_tasks.emplace_back();
+			heap_set(m_tasks.size() - 1, std::move(task));
+			sift_up(m_tasks.size() - 1);
+		}
+
+		bool heap_remove(task_t* task) {
+			const auto idx = task->heap_index;
+			if (idx >= m_tasks.size() || m_tasks[idx].get() != task)
+				return false;
+			task->heap_index = npos;
+			auto last = std::move(m_tasks.back());
+			m_tasks.pop_back();
+			if (idx < m_tasks.size()) {
+				heap_set(idx, std::move(last));
+				if (idx > 0 && m_tasks[idx]->tp < m_tasks[(idx - 1) / 2]->tp)
+					sift_up(idx);
+				else sift_down(idx);
+			}
+			return true;
+		}
+
+		std::shared_ptr<task_t> heap_pop() {
+			auto task = m_tasks.front();
+			heap_remove(task.get());
+			return task;
+		}
+
+		// Round tp up to the timer resolution, so close deadlines are handled in one wakeup
+		std::chrono::steady_clock::time_point round_deadline(std::chrono::steady_clock::time_point tp) const {
+			if (m_resolution.count() <= 0)
+				return tp;
+			const auto rem = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()) % m_resolution;
+			if (rem.count() == 0)
+				return tp;
+			return tp + std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_resolution - rem);
+		}
 
-		// Get all tasks that need to get executed
-		std::set<std::shared_ptr<task_t>> get_ready_tasks(bool remove = false) {
+		// Remove and return all tasks that need to get executed, ordered by deadline
+		std::vector<ready_task> get_ready_tasks() {
 			auto now = std::chrono::steady_clock::now();
-			std::set<std::shared_ptr<task_t>> res;
+			std::vector<ready_task> res;
 			std::unique_lock<std::mutex> lck(mtx);
-			for (auto it = m_tasks.begin(); it != m_tasks.end();) {
-				if ((*it)->tp <= now) {
-					res.insert(*it);
-					if (remove)
-						it = m_tasks.erase(it);
-					else it++;
-				}
-				else {
-					it++;
-				}
+			while (!m_tasks.empty() && m_tasks.front()->tp <= now) {
+				const auto deadline = m_tasks.front()->due;
+				res.push_back({ heap_pop(), deadline });
 			}
 			return res;
 		}
 
 		// Get the next task that needs to get executed
 		std::shared_ptr<task_t> get_next_task() {
-			std::shared_ptr<task_t> next;
-			for (auto& e : m_tasks) {
-				if (!next || e->tp < next->tp)
-					next = e;
+			return m_tasks.empty() ? nullptr : m_tasks.front();
+		}
+
+		// Needs mtx to be locked
+		void push_task(const std::shared_ptr<task_t>& task)
+		{
+			task->tp = round_deadline(task->due);
+			heap_push(task);
+			if (task->heap_index == 0) {
+				cv.notify_all();
 			}
-			return next;
 		}
 
 		void schedule(std::shared_ptr<task_t> task)
 		{
 			std::unique_lock<std::mutex> lck(mtx);
-			m_tasks.insert(task);
-			auto next = get_next_task();
-			if (next == task) {
-				cv.notify_all();
+			heap_remove(task.get());
+			task->generation = m_generation;
+			push_task(task);
+		}
+
+		// Put a periodic task back into the heap, reusing the task object
+		void rearm(const std::shared_ptr<task_t>& task, std::chrono::steady_clock::time_point started, std::chrono::steady_clock::time_point finished)
+		{
+			std::unique_lock<std::mutex> lck(mtx);
+			if (task->cancelled || task->generation != m_generation || exit_thread)
+				return;
+			switch (task->policy) {
+			case periodic_policy::fixed_start:
+				task->due = started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(task->period);
+				break;
+			case periodic_policy::fixed_delay:
+				task->due = finished + std::chrono::duration_cast<std::chrono::steady_clock::duration>(task->period);
+				break;
+			case periodic_policy::catch_up:
+				task->due += std::chrono::duration_cast<std::chrono::steady_clock::duration>(task->period);
+				break;
+			case periodic_policy::skip: {
+				const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(task->period);
+				task->due += period;
+				if (task->due <= finished)
+					task->due += period * ((finished - task->due) / period + 1);
+				break;
+			}
+			}
+			push_task(task);
+		}
+
+		void run_task(const ready_task& r) {
+			{
+				// Tasks cleared while they were waiting for a worker or the executor are dropped
+				std::unique_lock<std::mutex> lck(mtx);
+				if (r.task->cancelled || r.task->generation != m_generation)
+					return;
+			}
+			const auto started = std::chrono::steady_clock::now();
+			const auto lateness = std::chrono::duration_cast<std::chrono::nanoseconds>(started - r.deadline);
+			r.task->stats.record(lateness);
+			m_stats.record(lateness);
+			try {
+				r.task->fn();
+			}
+			catch (...) {
+				auto handler = get_exception_handler();
+				if(handler)
+					handler(std::current_exception());
+			}
+			if (r.task->period.count() > 0)
+				rearm(r.task, started, std::chrono::steady_clock::now());
+		}
+
+		void dispatch(std::vector<ready_task>& tasks) {
+			auto executor = get_executor();
+			if (executor) {
+				for (auto& r : tasks) {
+					executor([this, r]() { run_task(r); });
+				}
+			} else if (!m_workers.empty()) {
+				std::unique_lock<std::mutex> lck(m_queue_mtx);
+				for (auto& r : tasks)
+					m_queue.push_back(std::move(r));
+				if (tasks.size() == 1) m_queue_cv.notify_one();
+				else m_queue_cv.notify_all();
+			} else {
+				for (auto& r : tasks)
+					run_task(r);
+			}
+		}
+
+		void worker_fn() {
+			std::unique_lock<std::mutex> lck(m_queue_mtx);
+			while (true) {
+				m_queue_cv.wait(lck, [this]() { return m_queue_exit || !m_queue.empty(); });
+				if (m_queue.empty())
+					break;
+				auto r = std::move(m_queue.front());
+				m_queue.pop_front();
+				lck.unlock();
+				run_task(r);
+				lck.lock();
 			}
 		}
 
 		void thread_fn() {
 			while (!exit_thread) {
 				{
-					auto tasks = get_ready_tasks(true);
-					for (auto& task : tasks) {
-						try {
-							task->fn();
-						}
-						catch (...) {
-							auto handler = get_exception_handler();
-							if(handler)
-								handler(std::current_exception());
-						}
-					}
+					auto tasks = get_ready_tasks();
+					if (!tasks.empty())
+						dispatch(tasks);
 				}
 				{
 					std::unique_lock<std::mutex> lck(mtx);
@@ -107,9 +348,17 @@ namespace ttl {
 			}
 		}
 	public:
-		timer()
-			: exit_thread(false)
+		/**
+		 * resolution: deadlines are rounded up to a multiple of it, so timers expiring close to each other
+		 * are executed in one wakeup. Zero executes every timer as close to its deadline as possible.
+		 * workers: number of threads executing the handlers, with zero the handlers run on the timer thread
+		 * and a slow handler delays all other timers.
+		 */
+		explicit timer(std::chrono::nanoseconds resolution = std::chrono::nanoseconds(0), size_t workers = 0)
+			: m_resolution(resolution), exit_thread(false), m_queue_exit(false)
 		{
+			for (size_t i = 0; i < workers; i++)
+				m_workers.emplace_back(&timer::worker_fn, this);
 			thread = std::thread(std::bind(&timer::thread_fn, this));
 		}
 
@@ -122,13 +371,21 @@ namespace ttl {
 			}
 			if (thread.joinable())
 				thread.join();
+			// Handlers already taken from the heap were cleared above, the workers only drop them
+			{
+				std::unique_lock<std::mutex> lck(m_queue_mtx);
+				m_queue_exit = true;
+				m_queue_cv.notify_all();
+			}
+			for (auto& t : m_workers)
+				t.join();
 		}
 
 		token_t schedule(handler_fn_t fn, std::chrono::steady_clock::time_point tp)
 		{
 			auto task = std::make_shared<task_t>();
 			task->fn = fn;
-			task->tp = tp;
+			task->due = tp;
 			this->schedule(task);
 			return task;
 		}
@@ -146,34 +403,47 @@ namespace ttl {
 			return this->schedule(fn, dur);
 		}
 
+		/**
+		 * Execute fn periodically, starting one period from now.
+		 * The same task object is rearmed after each run, so no allocations happen per period.
+		 * A task never runs concurrently with itself, even if worker threads are used.
+		 */
 		token_t schedule(handler_fn_t fn, every t)
 		{
-			auto newtask = std::make_shared<task_t>();
-			auto weaktask = std::weak_ptr<task_t>(newtask);
-			auto dur = t.dur;
-			newtask->fn = [fn, dur, weaktask, this](){
-				auto task = weaktask.lock();
-				if(task) {
-					task->tp = std::chrono::steady_clock::now() + dur;
-					this->schedule(task);
-				}
-				fn();
-			};
-			newtask->tp = std::chrono::steady_clock::now() + t.dur;
-			this->schedule(newtask);
-			return newtask;
+			return this->schedule(fn, t, std::chrono::steady_clock::now() + t.dur);
+		}
+
+		// Execute fn periodically, starting at first
+		token_t schedule(handler_fn_t fn, every t, std::chrono::steady_clock::time_point first)
+		{
+			if (t.dur.count() <= 0)
+				throw std::invalid_argument("period must be positive");
+			auto task = std::make_shared<task_t>();
+			task->fn = fn;
+			task->due = first;
+			task->period = t.dur;
+			task->policy = t.policy;
+			this->schedule(task);
+			return task;
 		}
 
 		void clear(token_t t)
 		{
+			if (!t)
+				return;
 			std::unique_lock<std::mutex> lck(mtx);
-			m_tasks.erase(std::static_pointer_cast<task_t>(t));
+			auto task = static_cast<task_t*>(t.get());
+			task->cancelled = true;
+			heap_remove(task);
 		}
 
 		void clear_all()
 		{
 			std::unique_lock<std::mutex> lck(mtx);
+			for (auto& task : m_tasks)
+				task->heap_index = npos;
 			m_tasks.clear();
+			m_generation++;
 		}
 
 		void set_exception_handler(exception_fn_t fn)
@@ -187,6 +457,33 @@ namespace ttl {
 			std::unique_lock<std::mutex> lck(mtx);
 			return exception_handler;
 		}
+
+		// Hand expired handlers to fn instead of the internal workers or the timer thread
+		void set_executor(executor_fn_t fn)
+		{
+			std::unique_lock<std::mutex> lck(mtx);
+			m_executor = fn;
+		}
+
+		executor_fn_t get_executor() const
+		{
+			std::unique_lock<std::mutex> lck(mtx);
+			return m_executor;
+		}
+
+		size_t get_worker_count() const { return m_workers.size(); }
+
+		// Lateness of all executed handlers
+		task_stats get_stats() const {
+			return m_stats.get();
+		}
+
+		// Lateness of the task identified by token, all zero for an empty token
+		task_stats get_stats(const token_t& t) const {
+			if (!t)
+				return task_stats();
+			return static_cast<task_t*>(t.get())->stats.get();
+		}
 	};
 }
 
@@ -0,0 +1,357 @@
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "mmap.h"
+
+namespace ttl {
+	/**
+	 * Read only access to files larger than the desired address space budget.
+	 * The file is mapped in aligned windows of a fixed size, at most max_windows of them are kept
+	 * mapped and the least recently used one is evicted. If prefetching is enabled the window following
+	 * the one currently accessed is mapped (and paged in) by a background thread.
+	 * Windows are reference counted, so a cursor keeps its current window valid even if it gets evicted.
+	 */
+	class windowed_mmap {
+		class window {
+		public:
+			const uint8_t* data;
+			uint64_t offset;
+			size_t size;
+
+			window(const uint8_t* pdata, uint64_t poffset, size_t psize)
+				: data(pdata), offset(poffset), size(psize)
+			{}
+			window(const window&) = delete;
+			window& operator=(const window&) = delete;
+
+			~window() {
+#ifdef _WIN32
+				::UnmapViewOfFile(data);
+#else
+				::munmap(const_cast<uint8_t*>(data), size);
+#endif
+			}
+		};
+		typedef std::shared_ptr<window> window_ptr;
+
+#ifdef _WIN32
+		HANDLE _file;
+		HANDLE _mapped;
+#else
+		int _file;
+#endif
+		uint64_t _filesize;
+		size_t _window_size;
+		size_t _max_windows;
+		bool _prefetch;
+
+		std::mutex _mtx;
+		std::condition_variable _cv;
+		// Most recently used window first
+		std::list<window_ptr> _windows;
+		std::deque<uint64_t> _prefetch_queue;
+		bool _exit_thread;
+		std::thread _thread;
+
+		window_ptr map_window(uint64_t offset) const {
+			const size_t len = static_cast<size_t>(std::min<uint64_t>(_window_size, _filesize - offset));
+#ifdef _WIN32
+			DWORD offsetLow = DWORD(offset & 0xFFFFFFFF);
+			DWORD offsetHigh = DWORD(offset >> 32);
+			auto view = ::MapViewOfFile(_mapped, FILE_MAP_READ, offsetHigh, offsetLow, len);
+			if (view == nullptr)
+				throw std::runtime_error("failed to map window");
+#else
+			auto view = ::mmap64(nullptr, len, PROT_READ, MAP_SHARED, _file, static_cast<loff_t>(offset));
+			if (view == MAP_FAILED)
+				throw std::runtime_error("failed to map window");
+#endif
+			return std::make_shared<window>(reinterpret_cast<const uint8_t*>(view), offset, len);
+		}
+
+		// Needs to be called with _mtx locked
+		window_ptr find_window(uint64_t offset) {
+			for (auto it = _windows.begin(); it != _windows.end(); it++) {
+				if ((*it)->offset == offset) {
+					auto res = *it;
+					_windows.splice(_windows.begin(), _windows, it);
+					return res;
+				}
+			}
+			return nullptr;
+		}
+
+		// Needs to be called with _mtx locked
+		void insert_window(window_ptr w) {
+			_windows.push_front(std::move(w));
+			while (_windows.size() > _max_windows)
+				_windows.pop_back();
+		}
+
+		void prefetch_thread_fn() {
+			std::unique_lock<std::mutex> lck(_mtx);
+			while (!_exit_thread) {
+				if (_prefetch_queue.empty()) {
+					_cv.wait(lck);
+					continue;
+				}
+				auto offset = _prefetch_queue.front();
+				_prefetch_queue.pop_front();
+				bool cached = false;
+				for (auto& e : _windows) {
+					if (e->offset == offset) {
+						cached = true;
+						break;
+					}
+				}
+				if (cached)
+					continue;
+
+				lck.unlock();
+				window_ptr w;
+				try {
+					w = map_window(offset);
+#ifndef _WIN32
+					::madvise(const_cast<uint8_t*>(w->data), w->size, MADV_WILLNEED);
+#endif
+				}
+				catch (const std::exception&) {
+					// The reader will retry and report the error
+				}
+				lck.lock();
+				if (w && !find_window(offset))
+					insert_window(std::move(w));
+			}
+		}
+
+		window_ptr get_window(uint64_t pos) {
+			const uint64_t offset = pos - pos % _window_size;
+			const uint64_t next = offset + _window_size;
+			window_ptr res;
+			{
+				std::unique_lock<std::mutex> lck(_mtx);
+				res = find_window(offset);
+			}
+			if (!res) {
+				// Map without holding the lock
+				auto w = map_window(offset);
+				std::unique_lock<std::mutex> lck(_mtx);
+				res = find_window(offset);
+				if (!res) {
+					res = w;
+					insert_window(std::move(w));
+				}
+			}
+			if (_prefetch && next < _filesize) {
+				std::unique_lock<std::mutex> lck(_mtx);
+				bool known = std::find(_prefetch_queue.begin(), _prefetch_queue.end(), next) != _prefetch_queue.end();
+				for (auto it = _windows.begin(); !known && it != _windows.end(); it++) {
+					known = (*it)->offset == next;
+				}
+				if (!known) {
+					_prefetch_queue.push_back(next);
+					_cv.notify_all();
+				}
+			}
+			return res;
+		}
+	public:
+		/**
+		 * A read position inside a windowed_mmap.
+		 * Bytes are accessed through data() which returns the contiguous part of the current window
+		 * or copied across window boundaries using read(). The windowed_mmap needs to outlive the cursor.
+		 */
+		class cursor {
+			windowed_mmap* _map;
+			window_ptr _window;
+			uint64_t _pos;
+
+			bool ensure_window() {
+				if (_pos >= _map->_filesize)
+					return false;
+				if (!_window || _pos < _window->offset || _pos >= _window->offset + _window->size)
+					_window = _map->get_window(_pos);
+				return true;
+			}
+		public:
+			cursor(windowed_mmap& map, uint64_t pos)
+				: _map(&map), _pos(pos)
+			{}
+
+			uint64_t tell() const { return _pos; }
+			uint64_t remaining() const { return _pos < _map->_filesize ? _map->_filesize - _pos : 0; }
+			bool eof() const { return _pos >= _map->_filesize; }
+
+			void seek(uint64_t pos) { _pos = std::min(pos, _map->_filesize); }
+			void skip(uint64_t len) { seek(_pos + std::min(len, remaining())); }
+
+			// Pointer to the current position, len receives the number of bytes available without crossing a window
+			const uint8_t* data(size_t& len) {
+				if (!ensure_window()) {
+					len = 0;
+					return nullptr;
+				}
+				const auto off = static_cast<size_t>(_pos - _window->offset);
+				len = _window->size - off;
+				return _window->data + off;
+			}
+
+			// Copy up to len bytes to dst and advance, returns the number of bytes read
+			size_t read(void* dst, size_t len) {
+				auto out = reinterpret_cast<uint8_t*>(dst);
+				size_t res = 0;
+				while (res != len) {
+					size_t avail = 0;
+					auto ptr = data(avail);
+					if (ptr == nullptr)
+						break;
+					auto n = std::min(avail, len - res);
+					memcpy(out + res, ptr, n);
+					res += n;
+					_pos += n;
+				}
+				return res;
+			}
+
+			// Read a single byte and advance, throws at end of file
+			uint8_t get() {
+				if (!ensure_window())
+					throw std::out_of_range("end of file");
+				return _window->data[_pos++ - _window->offset];
+			}
+		};
+
+		explicit windowed_mmap(size_t window_size = 64 * 1024 * 1024, size_t max_windows = 4, bool prefetch = true)
+			:
+#ifdef _WIN32
+			_file(nullptr), _mapped(nullptr),
+#else
+			_file(-1),
+#endif
+			_filesize(0), _max_windows(std::max(max_windows, size_t(2))), _prefetch(prefetch), _exit_thread(false)
+		{
+			// Window offsets need to be aligned to the mapping granularity
+			const size_t granularity = ttl::mmap::page_size();
+			_window_size = std::max((window_size + granularity - 1) / granularity, size_t(1)) * granularity;
+		}
+
+		windowed_mmap(const std::string& fname, size_t window_size = 64 * 1024 * 1024, size_t max_windows = 4, bool prefetch = true)
+			: windowed_mmap(window_size, max_windows, prefetch)
+		{
+			if (!open(fname))
+				throw std::runtime_error("failed to open file");
+		}
+
+		windowed_mmap(const windowed_mmap&) = delete;
+		windowed_mmap& operator=(const windowed_mmap&) = delete;
+
+		~windowed_mmap() {
+			close();
+		}
+
+		bool open(const std::string& fname) {
+			close();
+#ifdef _WIN32
+			_file = ::CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+			if (!_file || _file == INVALID_HANDLE_VALUE) {
+				_file = nullptr;
+				return false;
+			}
+			LARGE_INTEGER result;
+			if (!GetFileSizeEx(_file, &result)) {
+				close();
+				return false;
+			}
+			_filesize = static_cast<uint64_t>(result.QuadPart);
+			if (_filesize != 0) {
+				_mapped = ::CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (!_mapped) {
+					close();
+					return false;
+				}
+			}
+#else
+			_file = ::open(fname.c_str(), O_RDONLY | O_LARGEFILE);
+			if (_file == -1)
+				return false;
+			struct stat64 statInfo;
+			if (fstat64(_file, &statInfo) < 0) {
+				close();
+				return false;
+			}
+			_filesize = static_cast<uint64_t>(statInfo.st_size);
+#endif
+			if (_prefetch) {
+				_exit_thread = false;
+				_thread = std::thread(&windowed_mmap::prefetch_thread_fn, this);
+			}
+			return true;
+		}
+
+		void close() {
+			{
+				std::unique_lock<std::mutex> lck(_mtx);
+				_exit_thread = true;
+				_prefetch_queue.clear();
+				_cv.notify_all();
+			}
+			if (_thread.joinable())
+				_thread.join();
+			{
+				std::unique_lock<std::mutex> lck(_mtx);
+				_windows.clear();
+			}
+#ifdef _WIN32
+			if (_mapped) {
+				::CloseHandle(_mapped);
+				_mapped = nullptr;
+			}
+			if (_file) {
+				::CloseHandle(_file);
+				_file = nullptr;
+			}
+#else
+			if (_file != -1) {
+				::close(_file);
+				_file = -1;
+			}
+#endif
+			_filesize = 0;
+		}
+
+		bool is_open() const {
+#ifdef _WIN32
+			return _file != nullptr;
+#else
+			return _file != -1;
+#endif
+		}
+
+		uint64_t size() const { return _filesize; }
+		size_t window_size() const { return _window_size; }
+		size_t max_windows() const { return _max_windows; }
+
+		// Number of windows currently mapped by the cache
+		size_t mapped_windows() {
+			std::unique_lock<std::mutex> lck(_mtx);
+			return _windows.size();
+		}
+
+		cursor begin(uint64_t pos = 0) {
+			return cursor(*this, pos);
+		}
+	};
+}
+
+#ifdef TTL_OLD_NAMESPACE
+namespace thalhammer = ttl;
+#endif